@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../hdr/Numa.h"
+
+namespace RkUtil {
+
+// how the pool's workers are pinned: not at all (beyond their NUMA node), each to its own cpu
+// with hyperthread siblings next to each other, each to its own core before any core gets a
+// second one, or to physical cores only (one worker per core, at most as many workers as cores)
+enum class Pinning { None, Compact, Scatter, Physical };
+
+static const std::map<std::string, Pinning> Pinnings = {
+    {"NONE", Pinning::None},
+    {"COMPACT", Pinning::Compact},
+    {"SCATTER", Pinning::Scatter},
+    {"PHYSICAL", Pinning::Physical},
+};
+
+/*
+ * What the process may really use, rather than what the host has: hardware_concurrency() counts
+ * every cpu, a container limited by a CFS quota or a taskset mask then runs ten times the workers
+ * it has cpus for. Usable cpus are the affinity mask capped by the cgroup quota (v2 cpu.max, v1
+ * cpu.cfs_quota_us / cpu.cfs_period_us) of the process's cgroup and its parents.
+*/
+class Affinity
+{
+public:
+    static std::vector<int> AllowedCpus(){
+
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0){
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+                if (CPU_ISSET(cpu, &set)){
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        return cpus;
+    }
+
+    // cpus the cgroup quota allows, 0: no quota
+    static double QuotaCpus(){
+
+        double limit = 0;
+        std::ifstream in("/proc/self/cgroup");
+        for (std::string line; std::getline(in, line); ){
+            // "0::/path" (v2) or "4:cpu,cpuacct:/path" (v1)
+            const std::size_t a = line.find(':'), b = line.find(':', a + 1);
+            if (a == std::string::npos || b == std::string::npos){
+                continue;
+            }
+            const std::string controllers = "," + line.substr(a + 1, b - a - 1) + ",";
+            const std::string path = line.substr(b + 1);
+            if (controllers == ",,"){
+                limit = Tighter(limit, WalkUp("/sys/fs/cgroup", path, [](const std::string& dir){
+                    return CpuMax(ReadLine(dir + "/cpu.max"));
+                }));
+            }else if (controllers.find(",cpu,") != std::string::npos){
+                for (const char* mount : {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"}){
+                    limit = Tighter(limit, WalkUp(mount, path, [](const std::string& dir){
+                        return CfsQuota(ReadLine(dir + "/cpu.cfs_quota_us"), ReadLine(dir + "/cpu.cfs_period_us"));
+                    }));
+                }
+            }
+        }
+        return limit;
+    }
+
+    // affinity mask capped by the quota, rounded up: 1.5 cpus worth of quota is 2 workers
+    static std::size_t UsableCpus(){
+
+        std::size_t cpus = std::max<std::size_t>(AllowedCpus().size(), 1);
+        const double quota = QuotaCpus();
+        if (quota > 0){
+            cpus = std::min(cpus, static_cast<std::size_t>(std::ceil(quota)));
+        }
+        return std::max<std::size_t>(cpus, 1);
+    }
+
+    // v2 cpu.max: "<quota> <period>" or "max <period>"
+    static double CpuMax(const std::string& line){
+
+        long long quota = 0, period = 0;
+        if (std::sscanf(line.c_str(), "%lld %lld", &quota, &period) != 2 || quota <= 0 || period <= 0){
+            return 0;
+        }
+        return double(quota) / period;
+    }
+
+    // v1: quota -1 is no limit
+    static double CfsQuota(const std::string& quota, const std::string& period){
+
+        return CpuMax(quota + " " + period);
+    }
+
+    /*
+     * The allowed cpus of every NUMA node in the order workers are pinned to them: Compact sorts by
+     * (package, core), so siblings are neighbours, Scatter takes the first thread of every core
+     * before the second of any, Physical keeps only the first. Empty lists for None.
+    */
+    static std::vector<std::vector<int>> PinOrder(Pinning pinning, const Numa& numa){
+
+        std::vector<std::vector<int>> order(numa.Nodes());
+        if (pinning == Pinning::None){
+            return order;
+        }
+        for (std::size_t node = 0; node < numa.Nodes(); ++node){
+            // (sibling rank, package, core, cpu)
+            std::vector<std::tuple<int, int, int, int>> cpus;
+            std::map<std::pair<int, int>, int> siblings;
+            for (int cpu : numa.Cpus(node)){
+                const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+                const int package = ReadInt(dir + "physical_package_id", 0);
+                const int core = ReadInt(dir + "core_id", cpu);
+                cpus.emplace_back(siblings[{package, core}]++, package, core, cpu);
+            }
+            if (pinning == Pinning::Compact){
+                std::sort(cpus.begin(), cpus.end(), [](const auto& a, const auto& b){
+                    return std::tie(std::get<1>(a), std::get<2>(a), std::get<0>(a)) <
+                           std::tie(std::get<1>(b), std::get<2>(b), std::get<0>(b));
+                });
+            }else{
+                std::sort(cpus.begin(), cpus.end());
+            }
+            for (const auto& c : cpus){
+                if (pinning != Pinning::Physical || std::get<0>(c) == 0){
+                    order[node].push_back(std::get<3>(c));
+                }
+            }
+        }
+        return order;
+    }
+
+    static void PinTo(int cpu){
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+private:
+    template<typename Limit>
+    static double WalkUp(const std::string& mount, std::string path, Limit limit){
+
+        double tightest = 0;
+        for (;;){
+            tightest = Tighter(tightest, limit(mount + (path == "/" ? "" : path)));
+            if (path.empty() || path == "/"){
+                return tightest;
+            }
+            path.erase(path.find_last_of('/'));
+            if (path.empty()){
+                path = "/";
+            }
+        }
+    }
+
+    static double Tighter(double a, double b){
+
+        return (a > 0 && b > 0) ? std::min(a, b) : std::max(a, b);
+    }
+
+    static std::string ReadLine(const std::string& path){
+
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    static int ReadInt(const std::string& path, int fallback){
+
+        try{
+            return std::stoi(ReadLine(path));
+        }catch(...){
+            return fallback;
+        }
+    }
+};
+
+}
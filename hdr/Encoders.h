@@ -3,13 +3,22 @@
 #include <array>
 #include <memory>
 #include <map>
+#include <functional>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <sys/mman.h>
 
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
-#ifdef MEMORY_OPTIMIZED
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include "../hdr/gzio.h"
-#endif
+#include "../hdr/gzindex.h"
+#include "../hdr/pinflate.h"
 #include "../hdr/command.h"
+#include "../hdr/Utility.h"
 
 class ComputeHistogram;
 
@@ -26,83 +35,509 @@ enum EncoderType : int16_t {
     EncodingTypeLast
 };
 
+// Which inflater the gzip encoder runs.
+enum class GzipBackend : uint8_t {
+    Boost = 0,  // boost::iostreams gzip_decompressor, single threaded
+    Gzio,       // NrrdIO derived gzio.cpp, inflates in chunks
+    Indexed,    // parallel inflate from a persisted access point index (zran)
+    Speculative // parallel inflate without an index, chunks guess their block start (pugz)
+};
+
+static std::map<std::string, GzipBackend> GzipBackends = {
+    {"BOOST", GzipBackend::Boost},
+    {"GZIO", GzipBackend::Gzio},
+    {"INDEXED", GzipBackend::Indexed},
+    {"SPECULATIVE", GzipBackend::Speculative},
+};
+
+#ifdef MEMORY_OPTIMIZED
+constexpr const char* DEFAULT_GZIP_BACKEND = "gzio";
+#else
+constexpr const char* DEFAULT_GZIP_BACKEND = "boost";
+#endif
+
+struct DecodeOptions {
+    std::size_t data_size = 0;      // decoded payload size as declared by the header
+    std::size_t chunk_size = 0;     // slice size handed to the sink, 0: encoder's natural granularity
+    std::size_t element_size = 1;   // slices never split a value
+    std::size_t workers = 1;        // threads an encoder may use to decode
+    GzipBackend gzip_backend = GzipBackend::Boost;
+    // bounded memory: decode into these buffers only, nothing the size of the whole payload
+    RkUtil::BufferRing* ring = nullptr;
+};
+
+// A buffer for size decoded bytes: from the ring if there is one, fresh otherwise.
+inline std::shared_ptr<char[]> DecodeBuffer(RkUtil::BufferRing* ring, std::size_t size){
+
+    if (ring && size <= ring->Size()){
+        return ring->Acquire();
+    }
+    return RkUtil::PayloadSlice::AllocateBuffer(size);
+}
+
+// Receives decoded payload as it is produced. Returning false tells the encoder to stop.
+using SliceSink = std::function<bool(RkUtil::PayloadSlice&&)>;
+
 class IEncoder {
 public:
-    virtual bool Parse(std::ifstream& file_stream, const std::string& file_name,
-                       const std::size_t data_size, std::vector<std::string>& fill) const noexcept = 0;
+    bool Parse(std::ifstream& file_stream, const std::string& file_name,
+               const DecodeOptions& options, std::vector<RkUtil::PayloadSlice>& fill) const noexcept{
+        return Stream(file_stream, file_name, options, CollectInto(fill));
+    }
+
+    // Decode the payload in slices of options.chunk_size bytes and hand each to sink as soon as
+    // it is ready, so consumers can work while decoding goes on. Slices may arrive out of order
+    // and from several threads (one at a time), but always hold whole values.
+    virtual bool Stream(std::ifstream& file_stream, const std::string& file_name,
+                        const DecodeOptions& options, const SliceSink& sink) const noexcept = 0;
+
+    // Slices are views of the file mapping rather than freshly decoded (cache hot) bytes.
+    virtual bool ZeroCopy() const noexcept { return false; }
+
+    // Stream() runs parallel loops of options.workers threads rather than decoding on the caller alone.
+    virtual bool DecodesInParallel(const DecodeOptions&) const noexcept { return false; }
     friend class ComputeHistogram;
+
+protected:
+    // Map everything after the header read-only. Payload is then consumed straight from
+    // the page cache instead of being read() into a zero filled string first.
+    static std::shared_ptr<boost::interprocess::mapped_region> MapPayload(std::ifstream& input_file_stream,
+                                                                          const std::string& file_name){
+
+        namespace bip = boost::interprocess;
+
+        const auto start = input_file_stream.tellg();
+        input_file_stream.seekg(0, std::ios_base::end);
+        const auto end = input_file_stream.tellg();
+        input_file_stream.seekg(start);
+        if (start < 0 || end <= start){
+            std::cout << "NRRD data error!! empty payload" << std::endl;
+            return nullptr;
+        }
+
+        bip::file_mapping mapping(file_name.data(), bip::read_only);
+        auto region = std::make_shared<bip::mapped_region>(mapping, bip::read_only,
+                                                           static_cast<bip::offset_t>(start),
+                                                           static_cast<std::size_t>(end - start));
+        region->advise(bip::mapped_region::advice_sequential);
+        return region;
+    }
+
+    // Give the whole pages of a mapping in [from, to) back, rounding both ends down: bounded
+    // memory mode reads files bigger than RAM, what was consumed must not stay resident. The
+    // mapping is read-only, a page touched again just faults back in from the page cache.
+    static void DropPages(const void* from, const void* to){
+
+        const std::uintptr_t page = boost::interprocess::mapped_region::get_page_size();
+        const std::uintptr_t lo = reinterpret_cast<std::uintptr_t>(from) & ~(page - 1);
+        const std::uintptr_t hi = reinterpret_cast<std::uintptr_t>(to) & ~(page - 1);
+        if (hi > lo){
+            madvise(reinterpret_cast<void*>(lo), hi - lo, MADV_DONTNEED);
+        }
+    }
+
+    static SliceSink CollectInto(std::vector<RkUtil::PayloadSlice>& fill){
+        return [&fill](RkUtil::PayloadSlice&& slice){
+            fill.push_back(std::move(slice));
+            return true;
+        };
+    }
+};
+
+// Cuts an inflated byte stream of arbitrary write sizes into fixed size slices.
+class SliceChunker {
+public:
+    SliceChunker(const std::size_t chunk_size, const SliceSink& sink, RkUtil::BufferRing* ring = nullptr)
+        : m_ChunkSize(std::max<std::size_t>(chunk_size, 1)),
+          m_Sink(sink),
+          m_Ring(ring) {}
+
+    void Write(const char* s, std::size_t n){
+
+        while (n > 0){
+            if (!m_Buffer){
+                m_Buffer = DecodeBuffer(m_Ring, m_ChunkSize);
+                m_Filled = 0;
+            }
+            const std::size_t c = std::min(n, m_ChunkSize - m_Filled);
+            std::memcpy(m_Buffer.get() + m_Filled, s, c);
+            m_Filled += c;
+            s += c;
+            n -= c;
+            if (m_Filled == m_ChunkSize){
+                Emit();
+            }
+        }
+    }
+
+    void Flush(){
+
+        if (m_Buffer && m_Filled > 0){
+            Emit();
+        }
+    }
+
+private:
+    void Emit(){
+
+        auto buffer = std::move(m_Buffer);
+        const char* data = buffer.get();
+        if (!m_Sink(RkUtil::PayloadSlice(std::move(buffer), data, m_Filled))){
+            throw std::runtime_error("consumer stopped");
+        }
+        m_Filled = 0;
+    }
+
+    const std::size_t m_ChunkSize;
+    const SliceSink& m_Sink;
+    RkUtil::BufferRing* m_Ring;
+    std::shared_ptr<char[]> m_Buffer;
+    std::size_t m_Filled = 0;
+};
+
+// boost::iostreams sink in front of a SliceChunker. Devices are copied by the chain so state lives in the chunker.
+struct ChunkingDevice {
+    typedef char char_type;
+    typedef boost::iostreams::sink_tag category;
+
+    std::streamsize write(const char* s, std::streamsize n){
+        chunker->Write(s, static_cast<std::size_t>(n));
+        return n;
+    }
+
+    SliceChunker* chunker;
 };
 
 class GzipEncoder : public IEncoder{
 
 public:
-    inline bool Parse(std::ifstream& input_file_stream, const std::string& file_name,
-                      const std::size_t data_size, std::vector<std::string>& fill) const noexcept override{
+    // all but boost, unless a memory budget has them inflate serially into the ring
+    bool DecodesInParallel(const DecodeOptions& options) const noexcept override{
+        return !options.ring && options.gzip_backend != GzipBackend::Boost;
+    }
 
-        static std::string empty_string("");
+    inline bool Stream(std::ifstream& input_file_stream, const std::string& file_name,
+                       const DecodeOptions& options, const SliceSink& sink) const noexcept override{
 
-#ifdef MEMORY_OPTIMIZED
-        // read compressed data in chunks with native zlib APIs
-        FILE* file = fopen(file_name.data(), "rb");
-        std::size_t len = 0;
-        // go until data part
-        for (char* line = NULL; (getline(&line, &len, file)) != -1; ) {
-            if (std::isspace(line[0])){
+        std::shared_ptr<boost::interprocess::mapped_region> region;
+        try{
+            region = MapPayload(input_file_stream, file_name);
+        }catch(std::exception& e){
+            std::cout << "NRRD data error!!" << e.what() << std::endl;
+            return false;
+        }
+        if (!region){
+            return false;
+        }
+        const char* compressed = static_cast<const char*>(region->get_address());
+        const std::size_t compressed_size = region->get_size();
+
+        // the parallel inflaters decode the whole payload into one buffer, within a memory budget
+        // the payload is inflated serially, chunk by chunk into the ring
+        if (options.ring){
+            return StreamGzio(compressed, compressed_size, options, sink);
+        }
+        switch (options.gzip_backend) {
+        case GzipBackend::Gzio:
+            return StreamGzio(compressed, compressed_size, options, sink);
+        case GzipBackend::Indexed:
+            return StreamIndexed(compressed, compressed_size, file_name, options, sink);
+        case GzipBackend::Speculative:
+            return StreamSpeculative(compressed, compressed_size, options, sink);
+        case GzipBackend::Boost:
+            break;
+        }
+        return StreamBoost(compressed, compressed_size, options, sink);
+    }
+
+private:
+    static constexpr std::size_t INDEX_MIN_SPAN = 1 << 20;
+    static constexpr std::size_t INDEX_MAX_POINTS = 256;
+    // below this much compressed input per chunk the block search costs more than it saves
+    static constexpr std::size_t SPECULATIVE_MIN_CHUNK = 1 << 20;
+
+    // Natural granularity of the chunked decoders: one slice per core.
+    static std::size_t ChunkSize(const DecodeOptions& options){
+
+        if (options.chunk_size){
+            return options.chunk_size;
+        }
+        std::size_t size = std::max<std::size_t>(options.data_size / std::max<std::size_t>(options.workers, 1), 1);
+        return std::max(size - (size % options.element_size), options.element_size);
+    }
+
+    // body(0) .. body(count - 1) on the task's executor (our pool or the TBB arena), on at most
+    // options.workers threads.
+    static void ParallelFor(const DecodeOptions& options, std::size_t count, const std::function<void(std::size_t)>& body){
+
+        Task::Exec().ParallelForUpTo(options.workers, count, body);
+    }
+
+    // Hand out a fully decoded payload as ChunkSize() views which share its buffer.
+    static void EmitViews(const std::shared_ptr<char[]>& decoded, std::uint64_t size,
+                          const DecodeOptions& options, const SliceSink& sink){
+
+        const std::size_t step = ChunkSize(options);
+        for (std::uint64_t offset = 0; offset < size; offset += step){
+            if (!sink(RkUtil::PayloadSlice(decoded, decoded.get() + offset,
+                                           std::min<std::uint64_t>(step, size - offset)))){
                 break;
             }
         }
+    }
+
+    bool StreamBoost(const char* compressed, const std::size_t compressed_size,
+                     const DecodeOptions& options, const SliceSink& sink) const noexcept{
+
+        try{
+            // Decompress whole string as possibility of corrupted data.
+            SliceChunker chunker(options.chunk_size ? options.chunk_size : std::max<std::size_t>(options.data_size, 1), sink, options.ring);
+            boost::iostreams::filtering_ostream decompressingStream;
+            decompressingStream.push(boost::iostreams::gzip_decompressor());
+            decompressingStream.push(ChunkingDevice{&chunker});
+            decompressingStream.write(compressed, compressed_size);
+            boost::iostreams::close(decompressingStream);
+            chunker.Flush();
+            return true;
+        }catch(std::exception& e){
+            std::cout << "NRRD data error!!" << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    bool StreamGzio(const char* compressed, const std::size_t compressed_size,
+                    const DecodeOptions& options, const SliceSink& sink) const noexcept{
+
+        // concatenated members (pigz, bgzip) inflate independently, one per worker
+        if (!options.ring && StreamGzioMembers(compressed, compressed_size, options, sink)){
+            return true;
+        }
+
+        // inflate in chunks with native zlib APIs, straight out of the mapping
         gzFile gzfin;
-        if ((gzfin = GzOpen(file, "rb")) == Z_NULL) {
+        if ((gzfin = GzOpenMem(compressed, compressed_size)) == Z_NULL) {
             return false;
         }
-        char* data = new char[data_size + 1]();
-        unsigned int didread, sizeChunk{data_size / Task::NO_OF_CORES};
+        const std::size_t data_size = options.data_size;
+        std::size_t didread, sizeChunk = ChunkSize(options);
         std::size_t sizeRed{0};
-        int error;
-        char* copy = data;
-        while (!(error = GzRead(gzfin, copy, sizeChunk, &didread))
-               && didread > 0) {
-            /* Increment the data pointer to the next available chunk. */
-            copy += didread;
-            {
-                std::string tmp(data + sizeRed, didread);
-                fill.push_back(std::move(tmp));
-            }
-            sizeRed += didread;
-            if (data_size >= sizeRed && data_size - sizeRed < sizeChunk){
-                sizeChunk = (uint)(data_size - sizeRed);
+        int error = 0;
+        try{
+            for (;;) {
+                // each chunk is decoded into its own buffer, which the slice then owns.
+                auto chunk = DecodeBuffer(options.ring, sizeChunk);
+                if ((error = GzRead(gzfin, chunk.get(), sizeChunk, &didread)) || didread == 0){
+                    break;
+                }
+                const char* data = chunk.get();
+                if (!sink(RkUtil::PayloadSlice(std::move(chunk), data, didread))){
+                    break;
+                }
+                if (options.ring){
+                    const void* consumed = GzInputPosition(gzfin);
+                    DropPages(compressed, consumed ? consumed : compressed);
+                }
+                sizeRed += didread;
+                if (data_size >= sizeRed && data_size - sizeRed < sizeChunk){
+                    sizeChunk = data_size - sizeRed;
+                }
+                if (sizeChunk == 0){
+                    break;
+                }
             }
+        }catch(std::exception& e){
+            std::cout << "NRRD data error!!" << e.what() << std::endl;
+            GzClose(gzfin);
+            return false;
         }
         GzClose(gzfin);
-        fclose(file);
 
+        // a corrupt or truncated stream must not pass for a smaller volume
+        if (error){
+            std::cout << "NRRD data error!! inflate failed: " << error << std::endl;
+            return false;
+        }
+        if (data_size && sizeRed != data_size){
+            std::cout << "NRRD data error!! decoded " << sizeRed << " of " << data_size << " bytes" << std::endl;
+            return false;
+        }
         return true;
-#else
-        (void)file_name;
-        (void)data_size;
-        auto start = input_file_stream.tellg();
-        input_file_stream.seekg(0, std::ios_base::end);
-        auto end = input_file_stream.tellg();
-        auto datasize = (end - start);
-        input_file_stream.seekg(start);
+    }
+
+    /*
+     * Member i is inflated straight into [out_i, out_i + isize_i) of one buffer, the offsets being
+     * the prefix sum of the trailer sizes. Returns false, before anything reached the sink, if the
+     * payload is a single member or its split into members did not hold up, the caller then
+     * inflates serially.
+    */
+    bool StreamGzioMembers(const char* compressed, const std::size_t compressed_size,
+                           const DecodeOptions& options, const SliceSink& sink) const noexcept{
+
+        std::vector<GzMember> members;
+        try{
+            if (GzListMembers(compressed, compressed_size, members) != Z_OK || members.size() < 2){
+                return false;
+            }
+            const std::uint64_t size = members.back().out + members.back().size;
+            if (options.data_size && size != options.data_size){
+                return false;
+            }
+            auto decoded = RkUtil::PayloadSlice::AllocateBuffer(size);
+            std::atomic<bool> failed{false};
+            ParallelFor(options, members.size(), [&](std::size_t i){
+                if (!failed && GzInflateMember(compressed, &members[i], decoded.get() + members[i].out) != Z_OK){
+                    failed = true;
+                }
+            });
+            if (failed){
+                return false;
+            }
+            EmitViews(decoded, size, options, sink);
+            return true;
+        }catch(std::exception& e){
+            return false;
+        }
+    }
+
+    /*
+     * The first read of a payload inflates serially like the other backends but also records
+     * access points, saved next to the input as <input>.gzidx. Every later read (different bins,
+     * min, max...) loads them and inflates the ranges between points on 'workers' threads,
+     * each straight into its final place in one decoded buffer.
+    */
+    bool StreamIndexed(const char* compressed, const std::size_t compressed_size, const std::string& file_name,
+                       const DecodeOptions& options, const SliceSink& sink) const noexcept{
 
-        std::string str(datasize, '\0');
-        if (input_file_stream.read(&str[0], datasize)){
-            try{
-                fill.resize(1);
-                // Decompress whole string as possibility of corrupted data.
-                boost::iostreams::filtering_ostream decompressingStream;
-                decompressingStream.push(boost::iostreams::gzip_decompressor());
-                decompressingStream.push(boost::iostreams::back_inserter(fill[0]));
-                decompressingStream.write(&str[0], str.size());
-                boost::iostreams::close(decompressingStream);
+        const auto* in = reinterpret_cast<const unsigned char*>(compressed);
+        const std::string index_file_name = file_name + ".gzidx";
+
+        RkGzIndex::GzIndex index;
+        if (RkGzIndex::LoadIndex(index_file_name, in, compressed_size, options.data_size, index)){
+            return InflateIndexedRanges(in, compressed_size, index, options, sink);
+        }
+
+        try{
+            const std::uint64_t span = std::max<std::uint64_t>(INDEX_MIN_SPAN, options.data_size / INDEX_MAX_POINTS);
+            SliceChunker chunker(ChunkSize(options), sink);
+            const int ret = RkGzIndex::BuildIndex(in, compressed_size, span, index,
+                                                  [&chunker](const unsigned char* data, std::size_t size){
+                chunker.Write(reinterpret_cast<const char*>(data), size);
                 return true;
-            }catch(std::exception& e){
-                std::cout << "NRRD data error!!" << e.what() << std::endl;
+            });
+            if (ret != Z_OK){
+                std::cout << "NRRD data error!! inflate failed: " << ret << std::endl;
+                return false;
+            }
+            // a payload ending on a member boundary short of the header's size is truncated, and its
+            // index would never load back
+            if (options.data_size && index.total_out != options.data_size){
+                std::cout << "NRRD data error!! decoded " << index.total_out << " of " << options.data_size << " bytes" << std::endl;
                 return false;
             }
+            chunker.Flush();
+        }catch(std::exception& e){
+            std::cout << "NRRD data error!!" << e.what() << std::endl;
+            return false;
+        }
+
+        if (!RkGzIndex::SaveIndex(index_file_name, index, in, compressed_size)){
+            std::cout << "could not save gzip index " << index_file_name << std::endl;
         }
-#endif
+        return true;
+    }
+
+    bool InflateIndexedRanges(const unsigned char* in, const std::size_t compressed_size,
+                              const RkGzIndex::GzIndex& index, const DecodeOptions& options,
+                              const SliceSink& sink) const noexcept{
+
+        const auto& points = index.points;
+        const std::size_t count = points.size();
+        const std::size_t element_size = options.element_size;
+
+        std::shared_ptr<char[]> decoded;
+        try{
+            decoded = RkUtil::PayloadSlice::AllocateBuffer(index.total_out);
+        }catch(std::exception& e){
+            std::cout << "NRRD data error!!" << e.what() << std::endl;
+            return false;
+        }
+
+        // range i decodes [begin[i], begin[i+1]), slice i hands out the whole values starting in it,
+        // [aligned[i], aligned[i+1]). A value cut by an access point needs the next range as well.
+        std::vector<std::uint64_t> begin(count + 1), aligned(count + 1);
+        for (std::size_t i = 0; i < count; ++i){
+            begin[i] = points[i].out;
+            aligned[i] = (begin[i] + element_size - 1) / element_size * element_size;
+        }
+        begin[count] = aligned[count] = index.total_out;
+
+        std::vector<char> done(count, 0), emitted(count, 0);
+        std::mutex guard;
+        std::atomic<bool> failed{false};
+
+        auto try_emit = [&](std::size_t i){
+            if (emitted[i] || !done[i] || (i + 1 < count && aligned[i + 1] > begin[i + 1] && !done[i + 1])){
+                return;
+            }
+            emitted[i] = 1;
+            if (aligned[i + 1] > aligned[i] &&
+                    !sink(RkUtil::PayloadSlice(decoded, decoded.get() + aligned[i], aligned[i + 1] - aligned[i]))){
+                failed = true;
+            }
+        };
+
+        ParallelFor(options, count, [&](std::size_t i){
+            if (failed){
+                return;
+            }
+            const int ret = RkGzIndex::InflateRange(in, compressed_size, points[i],
+                                                    reinterpret_cast<unsigned char*>(decoded.get() + begin[i]),
+                                                    begin[i + 1] - begin[i]);
+            if (ret != Z_OK){
+                std::cout << "NRRD data error!! inflate failed: " << ret << std::endl;
+                failed = true;
+                return;
+            }
+            std::lock_guard<std::mutex> lk(guard);
+            done[i] = 1;
+            if (i > 0){
+                try_emit(i - 1);
+            }
+            try_emit(i);
+        });
+
+        return !failed;
+    }
+
+    bool StreamSpeculative(const char* compressed, const std::size_t compressed_size,
+                           const DecodeOptions& options, const SliceSink& sink) const noexcept{
+
+        const std::size_t workers = std::max<std::size_t>(options.workers, 1);
+        // a few chunks per worker so one slow chunk does not hold up the rest
+        const std::size_t chunk_size = std::max(SPECULATIVE_MIN_CHUNK, compressed_size / (4 * workers));
+
+        auto parallel_for = [&options](std::size_t count, const std::function<void(std::size_t)>& body){
+            ParallelFor(options, count, body);
+        };
+
+        RkPInflate::Result result;
+        try{
+            const int ret = RkPInflate::Inflate(reinterpret_cast<const unsigned char*>(compressed), compressed_size,
+                                                chunk_size, parallel_for, result);
+            if (ret != Z_OK){
+                std::cout << "NRRD data error!! inflate failed: " << ret << std::endl;
+                return false;
+            }
+        }catch(std::exception& e){
+            std::cout << "NRRD data error!!" << e.what() << std::endl;
+            return false;
+        }
+
+        if (options.data_size && result.size != options.data_size){
+            std::cout << "NRRD data error!! decoded " << result.size << " of " << options.data_size << " bytes" << std::endl;
+            return false;
+        }
+        EmitViews(result.data, result.size, options, sink);
         return true;
     }
 
@@ -110,22 +545,25 @@ public:
 
 class RawEncoder : public IEncoder{
 public:
-    bool Parse(std::ifstream& input_file_stream, const std::string& file_name,
-               const std::size_t data_size, std::vector<std::string>& fill) const noexcept override{
-
-        (void)file_name;
-        (void)data_size;
+    bool ZeroCopy() const noexcept override { return true; }
 
-        auto start = input_file_stream.tellg();
-        input_file_stream.seekg(0, std::ios_base::end);
-        auto end = input_file_stream.tellg();
-        auto datasize = (end - start);
-        input_file_stream.seekg(start);
+    // chunk_size 0 hands over the whole mapping as one slice.
+    bool Stream(std::ifstream& input_file_stream, const std::string& file_name,
+                const DecodeOptions& options, const SliceSink& sink) const noexcept override{
 
         try{
-            std::string str(datasize, '\0');
-            if (input_file_stream.read(&str[0], datasize)){
-                fill.push_back(str);
+            // Zero-copy: slices point into the mapping and keep it alive.
+            auto region = MapPayload(input_file_stream, file_name);
+            if (region){
+                const char* start = static_cast<const char*>(region->get_address());
+                const std::size_t size = region->get_size();
+                const std::size_t step = options.chunk_size ? options.chunk_size : size;
+                for (std::size_t offset = 0; offset < size; offset += step){
+                    const std::size_t n = std::min(step, size - offset);
+                    if (!sink(RkUtil::PayloadSlice(options.ring ? Dropping(region, start + offset, n) : region, start + offset, n))){
+                        break;
+                    }
+                }
                 return true;
             }
         }catch(std::exception& e){
@@ -135,6 +573,19 @@ public:
 
         return false;
     }
+
+private:
+    // Within a memory budget: an owner which drops the slice's pages (see DropPages()) once the
+    // slice is done with. The last slice takes the mapping's partial last page along.
+    static std::shared_ptr<const void> Dropping(const std::shared_ptr<boost::interprocess::mapped_region>& region,
+                                                const char* data, std::size_t size){
+
+        const char* end = static_cast<const char*>(region->get_address()) + region->get_size();
+        const char* to = (data + size == end) ? end + boost::interprocess::mapped_region::get_page_size() - 1 : data + size;
+        return std::shared_ptr<const void>(data, [region, data, to](const void*){
+            DropPages(data, to);
+        });
+    }
 };
 
 std::array<std::shared_ptr<IEncoder>, 2> EncodersClasses = {
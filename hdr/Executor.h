@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/combinable.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#ifdef RK_WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include "../hdr/Numa.h"
+#include "../hdr/ThreadPool.h"
+
+namespace RkUtil {
+
+enum class ExecutionBackend { Pool, Tbb, OpenMp };
+
+// openmp only does something in a build configured WITH_OPENMP
+static const std::map<std::string, ExecutionBackend> ExecutionBackends = {
+    {"POOL", ExecutionBackend::Pool},
+    {"TBB", ExecutionBackend::Tbb},
+    {"OPENMP", ExecutionBackend::OpenMp},
+};
+
+/*
+ * Where a task's parallel loops run. The histogram only ever asks for loops over indices and for
+ * chunks folded into per thread state, so the threads can be our own pool's, those of a host
+ * application's TBB arena or an OpenMP team, picked at runtime (--backend).
+ * Loop bodies must not start parallel loops themselves.
+*/
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+
+    // most bodies running at once: how many per thread states Fold() needs
+    virtual std::size_t Concurrency() const = 0;
+
+    // body(0) .. body(count - 1)
+    virtual void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body) = 0;
+
+    // the same on at most 'threads' threads, the calling one included: a loop sharing the cpus
+    // with threads of its own (the pipeline's consumers) leaves them room
+    virtual void ParallelForUpTo(std::size_t threads, std::size_t count,
+                                 const std::function<void(std::size_t)>& body) = 0;
+
+    // body(node, i) for every i < counts[node], preferably on threads of that NUMA node. By default
+    // one flat loop, for executors which don't place their threads.
+    virtual void ParallelForNodes(const std::vector<std::size_t>& counts,
+                                  const std::function<void(std::size_t, std::size_t)>& body){
+
+        std::vector<std::size_t> first(counts.size() + 1, 0);
+        for (std::size_t n = 0; n < counts.size(); ++n){
+            first[n + 1] = first[n] + counts[n];
+        }
+        ParallelFor(first.back(), [&first, &body](std::size_t i){
+            const std::size_t node = std::upper_bound(first.begin(), first.end(), i) - first.begin() - 1;
+            body(node, i - first[node]);
+        });
+    }
+
+    // body(chunk, slot) for every chunk < nodes.size(), nodes[chunk] the NUMA node holding it.
+    // Calls running at the same time never share a slot, slots are < Concurrency().
+    virtual void Fold(const std::vector<std::size_t>& nodes,
+                      const std::function<void(std::size_t, std::size_t)>& body) = 0;
+};
+
+/*
+ * Our own pool. Fold() deals the chunks out to one work stealing deque per worker, worker w gets
+ * the w-th run of chunks and folds every chunk it ends up with into slot w. Equal shares finish
+ * unevenly as soon as the chunks differ or a core is shared, stealing evens that out.
+ * On a NUMA host the slots are split over the nodes like the pool's threads, the chunks go to the
+ * slots of the node their memory is on and are stolen within the node first.
+*/
+class PoolExecutor : public Executor
+{
+public:
+    PoolExecutor(ThreadPool& pool, std::size_t workers)
+        : m_Pool(pool),
+          m_Workers(std::max<std::size_t>(workers, 1)) {}
+
+    std::size_t Concurrency() const override { return m_Workers; }
+
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body) override{
+
+        m_Pool.ParallelFor(m_Workers, count, body);
+    }
+
+    void ParallelForUpTo(std::size_t threads, std::size_t count,
+                         const std::function<void(std::size_t)>& body) override{
+
+        m_Pool.ParallelFor(std::min(threads, m_Workers), count, body);
+    }
+
+    void ParallelForNodes(const std::vector<std::size_t>& counts,
+                          const std::function<void(std::size_t, std::size_t)>& body) override{
+
+        m_Pool.ParallelForNodes(m_Workers, counts, body);
+    }
+
+    void Fold(const std::vector<std::size_t>& nodes,
+              const std::function<void(std::size_t, std::size_t)>& body) override{
+
+        const std::size_t groups = std::min(Numa::Topology().Nodes(), m_Workers);
+        std::vector<std::vector<std::size_t>> chunks(groups);
+        for (std::size_t i = 0; i < nodes.size(); ++i){
+            chunks[nodes[i] % groups].push_back(i);
+        }
+
+        StealingQueues<std::size_t> queues(m_Workers, groups);
+        std::vector<std::size_t> counts(groups);
+        for (std::size_t n = 0; n < groups; ++n){
+            const std::size_t first = Numa::FirstWorker(n, m_Workers, groups);
+            counts[n] = Numa::FirstWorker(n + 1, m_Workers, groups) - first;
+            for (std::size_t i = 0; i < chunks[n].size(); ++i){
+                queues.Push(first + i * counts[n] / chunks[n].size(), chunks[n][i]);
+            }
+        }
+        m_Pool.ParallelForNodes(m_Workers, counts, [this, &queues, &body, groups](std::size_t node, std::size_t i){
+            const std::size_t w = Numa::FirstWorker(node, m_Workers, groups) + i;
+            for (std::size_t chunk; queues.Pop(w, chunk); ){
+                body(chunk, w);
+            }
+        });
+    }
+
+private:
+    ThreadPool& m_Pool;
+    std::size_t m_Workers;
+};
+
+/*
+ * The TBB arena of the calling thread: inside a TBB based host the histogram shares the host's
+ * threads rather than starting its own next to them. The auto partitioner sizes the ranges,
+ * every thread takes a slot (a combinable, numbered on first use) the first time it runs one and
+ * folds into that slot from then on. The per slot histograms are summed by the task's blocked
+ * Reduce() rather than by pairwise joins.
+ * No NUMA placement beyond what the arena does itself.
+*/
+class TbbExecutor : public Executor
+{
+public:
+    std::size_t Concurrency() const override{
+
+        return std::max(tbb::this_task_arena::max_concurrency(), 1);
+    }
+
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body) override{
+
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, count), [&body](const tbb::blocked_range<std::size_t>& r){
+            for (std::size_t i = r.begin(); i < r.end(); ++i){
+                body(i);
+            }
+        }, tbb::auto_partitioner());
+    }
+
+    void ParallelForUpTo(std::size_t threads, std::size_t count,
+                         const std::function<void(std::size_t)>& body) override{
+
+        if (threads >= Concurrency()){
+            ParallelFor(count, body);
+            return;
+        }
+        tbb::task_arena arena(static_cast<int>(std::max<std::size_t>(threads, 1)));
+        arena.execute([this, count, &body]{ ParallelFor(count, body); });
+    }
+
+    void Fold(const std::vector<std::size_t>& nodes,
+              const std::function<void(std::size_t, std::size_t)>& body) override{
+
+        std::atomic<std::size_t> next{0};
+        tbb::combinable<std::size_t> slot([&next]{ return next++; });
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, nodes.size()), [&slot, &body](const tbb::blocked_range<std::size_t>& r){
+            const std::size_t s = slot.local();
+            for (std::size_t i = r.begin(); i < r.end(); ++i){
+                body(i, s);
+            }
+        }, tbb::auto_partitioner());
+    }
+};
+
+#ifdef RK_WITH_OPENMP
+/*
+ * The OpenMP runtime's thread team: tools which are OpenMP based themselves share theirs with the
+ * histogram. Slots are omp_get_thread_num() of the team, chunks are handed out dynamically.
+ * Called from inside a parallel region the loops get a nested team (of one unless the host
+ * enables nesting).
+*/
+class OmpExecutor : public Executor
+{
+public:
+    std::size_t Concurrency() const override{
+
+        return std::max(omp_get_max_threads(), 1);
+    }
+
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body) override{
+
+        const std::int64_t n = count;
+#pragma omp parallel for schedule(dynamic)
+        for (std::int64_t i = 0; i < n; ++i){
+            body(i);
+        }
+    }
+
+    void ParallelForUpTo(std::size_t threads, std::size_t count,
+                         const std::function<void(std::size_t)>& body) override{
+
+        const std::int64_t n = count;
+        const int team = static_cast<int>(std::min<std::size_t>(std::max<std::size_t>(threads, 1), Concurrency()));
+#pragma omp parallel for schedule(dynamic) num_threads(team)
+        for (std::int64_t i = 0; i < n; ++i){
+            body(i);
+        }
+    }
+
+    void Fold(const std::vector<std::size_t>& nodes,
+              const std::function<void(std::size_t, std::size_t)>& body) override{
+
+        const std::int64_t n = nodes.size();
+#pragma omp parallel
+        {
+            const std::size_t slot = omp_get_thread_num();
+#pragma omp for schedule(dynamic)
+            for (std::int64_t i = 0; i < n; ++i){
+                body(i, slot);
+            }
+        }
+    }
+};
+#endif
+
+}
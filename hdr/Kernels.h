@@ -0,0 +1,847 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include <cstring>
+
+#include "../hdr/Utility.h"
+#include "../hdr/SimdKernels.h"
+
+/*
+ * Histogram inner loops, one instantiation per (element type, counter type, binning).
+ * The element type is fixed at compile time so there is no per voxel switch on the payload type,
+ * integer payloads are binned as integers (no round trip through double) and the counters are
+ * written through a raw pointer: the binning guarantees every index is in [0, bins - 1].
+ * The type dispatch happens once, when the kernel is made, and the kernel is called once per slice.
+ *
+ * Binning follows unu histo: bin = floor((v - min) * bins / (max - min)), v == max falls into the
+ * last bin and values outside of [min, max] are clamped onto its ends.
+*/
+namespace RkKernels {
+
+// Whether values can fall outside of [min, max] and have to be clamped onto its ends.
+enum class ClampPolicy : std::uint8_t {
+    None,   // the element type cannot hold a value outside of [min, max]
+    Clamp
+};
+
+template<typename Counter>
+using Kernel = std::function<void(const std::string_view& data, Counter* hist)>;
+
+// "Counter" of index kernels: Kernel<BinIndex> writes the bin of voxel i to out[i] instead of counting.
+enum class BinIndex : std::uint32_t {};
+
+/*
+ * Integer payload and integer min / max: ((v - min) * mul) >> shift, exact.
+ * With R = max - min, mul = ceil(2^shift * bins / R) is off by e = mul * R - 2^shift * bins < R,
+ * which adds at most d * e / (R * 2^shift) to the quotient of d = v - min. That stays below 1 / R,
+ * i.e. never crosses the next integer, as long as R * R <= 2^shift.
+*/
+template<typename T, ClampPolicy P>
+struct FixedPointBinning {
+    // wide enough for min, max and any value of T
+    using W = std::conditional_t<std::is_same_v<T, std::uint64_t>, std::uint64_t, std::int64_t>;
+
+    W lo;
+    W hi;
+    std::uint64_t mul;
+    int shift;
+    std::uint64_t last;
+
+    static bool Make(double min, double max, std::size_t bins, FixedPointBinning& binning){
+
+        constexpr double LIMIT = 4611686018427387904.0; // 2^62
+        if (std::floor(min) != min || std::floor(max) != max || !(min < max) ||
+                min < (std::is_signed_v<W> ? -LIMIT : 0.0) || max > LIMIT){
+            return false;
+        }
+        binning.lo = static_cast<W>(min);
+        binning.hi = static_cast<W>(max);
+        const std::uint64_t range = static_cast<std::uint64_t>(binning.hi - binning.lo);
+        int range_bits = 0, bins_bits = 0;
+        for (std::uint64_t r = range; r; r >>= 1) ++range_bits;
+        for (std::uint64_t b = bins; b; b >>= 1) ++bins_bits;
+        binning.shift = 2 * range_bits;
+        // d * mul <= 2^shift * bins + range has to fit 64 bits
+        if (binning.shift + bins_bits > 63){
+            return false;
+        }
+        const unsigned __int128 scaled = static_cast<unsigned __int128>(bins) << binning.shift;
+        binning.mul = static_cast<std::uint64_t>((scaled + range - 1) / range);
+        binning.last = bins - 1;
+        return true;
+    }
+
+    std::size_t operator()(T v) const {
+        W w = static_cast<W>(v);
+        if constexpr (P == ClampPolicy::Clamp){
+            // branch free (cmov), out of range values are not predictable
+            w = std::min(std::max(w, lo), hi);
+        }
+        const std::uint64_t d = static_cast<std::uint64_t>(w) - static_cast<std::uint64_t>(lo);
+        return static_cast<std::size_t>(std::min((d * mul) >> shift, last));
+    }
+};
+
+// Anything else: (v - min) times the precomputed reciprocal bins / (max - min).
+template<typename T, ClampPolicy P>
+struct ScaledBinning {
+    double lo;
+    double hi;
+    double scale;
+    std::size_t last;
+
+    static bool Make(double min, double max, std::size_t bins, ScaledBinning& binning){
+
+        binning.lo = min;
+        binning.hi = max;
+        binning.scale = static_cast<double>(bins) / (max - min);
+        binning.last = bins - 1;
+        return min < max && std::isfinite(binning.scale);
+    }
+
+    std::size_t operator()(T v) const {
+        double x = static_cast<double>(v);
+        if constexpr (P == ClampPolicy::Clamp){
+            // written so NaN lands on min
+            x = !(x >= lo) ? lo : (x > hi ? hi : x);
+        }
+        return std::min(static_cast<std::size_t>((x - lo) * scale), last);
+    }
+};
+
+/*
+ * 8 and 16 bit payloads: every value there is gets its bin up front, from either binning above.
+ * The loop is then one table load per voxel and clamping is baked into the table entries.
+ * The table is shared read-only by all copies of the kernel, i.e. by all workers.
+*/
+template<typename T, typename Index>
+struct LookupBinning {
+    std::shared_ptr<const Index[]> owner;
+    const Index* table;
+
+    template<typename Binning>
+    static LookupBinning Make(const Binning& binning){
+
+        using U = std::make_unsigned_t<T>;
+        constexpr std::size_t ENTRIES = std::size_t(std::numeric_limits<U>::max()) + 1;
+        // one spare entry: the vector kernels gather uint16 entries as 32 bit words
+        std::shared_ptr<Index[]> entries(new Index[ENTRIES + 1]);
+        // indexed by the value's bit pattern, so negative values sit in the upper half
+        for (std::size_t u = 0; u < ENTRIES; ++u){
+            entries[u] = static_cast<Index>(binning(static_cast<T>(static_cast<U>(u))));
+        }
+        entries[ENTRIES] = 0;
+        LookupBinning lookup;
+        lookup.table = entries.get();
+        lookup.owner = std::move(entries);
+        return lookup;
+    }
+
+    std::size_t operator()(T v) const {
+        return table[static_cast<std::make_unsigned_t<T>>(v)];
+    }
+};
+
+/*
+ * Where the counters live decides how the increments are issued:
+ * L1     - SUB_HISTOGRAMS interleaved copies of the counters, voxel i goes to copy i % SUB_HISTOGRAMS
+ *          and the copies are folded into the histogram at the end of the slice. Back to back voxels
+ *          of the same value (air in CT) no longer wait on the store of the previous increment.
+ *          Only when all copies together still fit L1, otherwise the fold and the misses eat the gain.
+ *          ~3.5x on uchar data that is 90% one value, even on uniform data; 8 copies measured no better.
+ * L2     - straight loop, out of order execution overlaps the binning of the next voxels with the
+ *          increment of this one on its own.
+ * Narrow - the wide counters no longer fit L2 but NarrowCounter ones do: count into a local array
+ *          of those and carry into the wide histogram when one wraps (every 256 increments of a
+ *          bin), fold the rest in at the end of the slice. Exact, and the footprint the increments
+ *          walk is a quarter. On 40M ints (SPR, 2MB L2) 1.4x - 2x faster than the batched loop
+ *          from 600K to 2M bins, uniform or 90% one value. uint16 counters measured no better than
+ *          uint8 anywhere, nor than the straight loop while the wide counters fit L2.
+ * Memory - bin a batch of values first (vectorises, no stores in the way) then do the increments
+ *          back to back so many misses are in flight at once. On 20M ints ~30% faster than the
+ *          straight loop from 4M bins on, ~50% slower while the counters still fit L2.
+*/
+enum class Residency : std::uint8_t {
+    L1,
+    L2,
+    Narrow,
+    Memory
+};
+
+constexpr std::size_t SUB_HISTOGRAMS = 4;
+using NarrowCounter = std::uint8_t;
+
+// Half of a level is left to the streamed data and whatever else the core is doing.
+inline Residency PickResidency(std::size_t bins, std::size_t counter_size){
+
+    static const std::size_t l1 = RkUtil::CacheSize(1);
+    static const std::size_t l2 = RkUtil::CacheSize(2);
+    const std::size_t bytes = bins * counter_size;
+    if (bytes * SUB_HISTOGRAMS <= l1 / 2){
+        return Residency::L1;
+    }
+    if (bytes <= l2 / 2){
+        return Residency::L2;
+    }
+    // the local array is only read and written where the voxels land, the whole of L2 is fine
+    return (counter_size > sizeof(NarrowCounter) && bins * sizeof(NarrowCounter) <= l2) ? Residency::Narrow : Residency::Memory;
+}
+
+constexpr std::size_t BATCH_SIZE = 256;
+
+template<typename T, typename Counter, typename Binning>
+void AccumulateStraight(const std::string_view& data, Counter* hist, const Binning binning){
+
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    for (std::size_t idx = 0; idx < size; idx += sizeof(T)){
+        hist[binning(RkUtil::DecodeBytesSpcialized<T>(data, idx))] += 1;
+    }
+}
+
+template<typename T, typename Counter, typename Binning>
+void AccumulateBatched(const std::string_view& data, Counter* hist, const Binning binning){
+
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    std::uint32_t idxs[BATCH_SIZE];
+    for (std::size_t idx = 0; idx < size; ){
+        const std::size_t n = std::min(BATCH_SIZE, (size - idx) / sizeof(T));
+        for (std::size_t k = 0; k < n; ++k, idx += sizeof(T)){
+            idxs[k] = static_cast<std::uint32_t>(binning(RkUtil::DecodeBytesSpcialized<T>(data, idx)));
+        }
+        for (std::size_t k = 0; k < n; ++k){
+            hist[idxs[k]] += 1;
+        }
+    }
+}
+
+// Narrow is the local counter type, any unsigned type narrower than Counter.
+template<typename T, typename Narrow, typename Counter, typename Binning>
+void AccumulateNarrow(const std::string_view& data, Counter* hist, const Binning binning, std::size_t bins){
+
+    static_assert(std::is_unsigned_v<Narrow> && sizeof(Narrow) < sizeof(Counter));
+    constexpr Counter WRAP = Counter(std::numeric_limits<Narrow>::max()) + 1;
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    if (size / sizeof(T) < bins){
+        // too short to pay for zeroing and folding the local counters
+        AccumulateBatched<T, Counter>(data, hist, binning);
+        return;
+    }
+    std::vector<Narrow> counts(bins);
+    Narrow* local = counts.data();
+    for (std::size_t idx = 0; idx < size; idx += sizeof(T)){
+        const std::size_t b = binning(RkUtil::DecodeBytesSpcialized<T>(data, idx));
+        if (++local[b] == 0){
+            hist[b] += WRAP;
+        }
+    }
+    for (std::size_t b = 0; b < bins; ++b){
+        hist[b] += local[b];
+    }
+}
+
+template<typename T, typename Counter, Residency R, typename Binning>
+void Accumulate(const std::string_view& data, Counter* hist, const Binning binning, std::size_t bins){
+
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    if constexpr (R == Residency::L1){
+        // copy k of bin b sits at b * SUB_HISTOGRAMS + k, i.e. the copies of a bin share a cache line
+        constexpr std::size_t STEP = SUB_HISTOGRAMS * sizeof(T);
+        if (size / sizeof(T) < bins * SUB_HISTOGRAMS){
+            // too short to pay for zeroing and folding the copies
+            AccumulateStraight<T, Counter>(data, hist, binning);
+            return;
+        }
+        std::vector<Counter> copies(bins * SUB_HISTOGRAMS);
+        Counter* sub = copies.data();
+        const std::size_t body = size - (size % STEP);
+        std::size_t idx = 0;
+        for (; idx < body; idx += STEP){
+            for (std::size_t k = 0; k < SUB_HISTOGRAMS; ++k){
+                sub[binning(RkUtil::DecodeBytesSpcialized<T>(data, idx + k * sizeof(T))) * SUB_HISTOGRAMS + k] += 1;
+            }
+        }
+        for (; idx < size; idx += sizeof(T)){
+            hist[binning(RkUtil::DecodeBytesSpcialized<T>(data, idx))] += 1;
+        }
+        for (std::size_t b = 0; b < bins; ++b){
+            Counter c = 0;
+            for (std::size_t k = 0; k < SUB_HISTOGRAMS; ++k){
+                c += sub[b * SUB_HISTOGRAMS + k];
+            }
+            hist[b] += c;
+        }
+    }else if constexpr (R == Residency::L2){
+        AccumulateStraight<T, Counter>(data, hist, binning);
+    }else if constexpr (R == Residency::Narrow){
+        AccumulateNarrow<T, NarrowCounter, Counter>(data, hist, binning, bins);
+    }else{
+        AccumulateBatched<T, Counter>(data, hist, binning);
+    }
+}
+
+template<typename T, typename Binning>
+void BinIndices(const std::string_view& data, BinIndex* out, const Binning binning){
+
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    for (std::size_t idx = 0; idx < size; idx += sizeof(T)){
+        *out++ = static_cast<BinIndex>(binning(RkUtil::DecodeBytesSpcialized<T>(data, idx)));
+    }
+}
+
+// bins picks the loop above, it is the length of the counter array the kernel will be handed
+template<typename T, typename Counter, typename Binning>
+Kernel<Counter> WrapKernel(const Binning& binning, std::size_t bins){
+
+    if constexpr (std::is_same_v<Counter, BinIndex>){
+        return [binning](const std::string_view& data, BinIndex* out){
+            Dispatch([&]{ BinIndices<T>(data, out, binning); });
+        };
+    }else{
+        switch (PickResidency(bins, sizeof(Counter))){
+        case Residency::L1:
+            return [binning, bins](const std::string_view& data, Counter* hist){
+                Dispatch([&]{ Accumulate<T, Counter, Residency::L1>(data, hist, binning, bins); });
+            };
+        case Residency::L2:
+            return [binning, bins](const std::string_view& data, Counter* hist){
+                Dispatch([&]{ Accumulate<T, Counter, Residency::L2>(data, hist, binning, bins); });
+            };
+        case Residency::Narrow:
+            if constexpr (sizeof(Counter) > sizeof(NarrowCounter)){
+                return [binning, bins](const std::string_view& data, Counter* hist){
+                    Dispatch([&]{ Accumulate<T, Counter, Residency::Narrow>(data, hist, binning, bins); });
+                };
+            }
+            break;
+        case Residency::Memory:
+            break;
+        }
+        return [binning, bins](const std::string_view& data, Counter* hist){
+            Dispatch([&]{ Accumulate<T, Counter, Residency::Memory>(data, hist, binning, bins); });
+        };
+    }
+}
+
+/*
+ * Table lookup kernel, vectorised where it pays (SimdKernels.h). Measured on 40M voxels (SPR):
+ * while the sub histograms fit L1 the scalar loop beats both vector loops, the gathers are not
+ * cheaper than the scalar table loads and the increments are the bottleneck either way. Past that,
+ * 16 bit payloads with one dominant value (CT air) run 2x faster with the conflict detecting
+ * scatter and ~10% slower on uniform data.
+*/
+template<typename T, typename Counter, typename Index>
+Kernel<Counter> LookupKernel(const LookupBinning<T, Index>& lookup, std::size_t bins){
+
+    // index kernels only bin, nothing to vectorise the increments of; 8 bit payloads touch at most 256 bins
+    if constexpr (!std::is_same_v<Counter, BinIndex> && sizeof(T) == 2){
+        const bool sub_histograms = PickResidency(bins, sizeof(Counter)) == Residency::L1;
+        if (!sub_histograms){
+            switch (ActiveIsa()){
+            case Isa::Avx512:
+                return [lookup](const std::string_view& data, Counter* hist){
+                    AccumulateAvx512<T, Counter>(data, hist, lookup.table);
+                };
+            case Isa::Avx2:
+                return [lookup](const std::string_view& data, Counter* hist){
+                    AccumulateAvx2<T, Counter>(data, hist, lookup.table);
+                };
+            case Isa::Scalar:
+                break;
+            }
+        }
+    }
+    return WrapKernel<T, Counter>(lookup, bins);
+}
+
+template<typename T, typename Counter, typename Binning>
+Kernel<Counter> BinnedKernel(const Binning& binning, std::size_t bins){
+
+    if constexpr (std::is_integral_v<T> && sizeof(T) <= 2){
+        if (bins <= std::size_t(std::numeric_limits<std::uint16_t>::max()) + 1){
+            return LookupKernel<T, Counter>(LookupBinning<T, std::uint16_t>::Make(binning), bins);
+        }
+        return LookupKernel<T, Counter>(LookupBinning<T, std::uint32_t>::Make(binning), bins);
+    }
+    return WrapKernel<T, Counter>(binning, bins);
+}
+
+template<typename T, typename Counter, template<typename, ClampPolicy> class Binning>
+Kernel<Counter> MakeBinnedKernel(double min, double max, std::size_t bins){
+
+    // no clamp needed when [min, max] covers every value T can hold
+    if (std::is_integral_v<T> &&
+            min <= static_cast<double>(std::numeric_limits<T>::lowest()) &&
+            max >= static_cast<double>(std::numeric_limits<T>::max())){
+        Binning<T, ClampPolicy::None> binning;
+        if (!Binning<T, ClampPolicy::None>::Make(min, max, bins, binning)){
+            return nullptr;
+        }
+        return BinnedKernel<T, Counter>(binning, bins);
+    }
+    Binning<T, ClampPolicy::Clamp> binning;
+    if (!Binning<T, ClampPolicy::Clamp>::Make(min, max, bins, binning)){
+        return nullptr;
+    }
+    return BinnedKernel<T, Counter>(binning, bins);
+}
+
+template<typename T, typename Counter>
+Kernel<Counter> MakeTypedKernel(double min, double max, std::size_t bins){
+
+    if constexpr (std::is_integral_v<T>){
+        if (auto kernel = MakeBinnedKernel<T, Counter, FixedPointBinning>(min, max, bins)){
+            return kernel;
+        }
+    }
+    return MakeBinnedKernel<T, Counter, ScaledBinning>(min, max, bins);
+}
+
+// Kernel for a payload type, nullptr if (min, max, bins) cannot be binned.
+template<typename Counter>
+Kernel<Counter> MakeKernel(RkUtil::PAYLOAD_TYPE type, double min, double max, std::size_t bins){
+
+    using RkUtil::PAYLOAD_TYPE;
+    switch (type) {
+    case PAYLOAD_TYPE::TypeUChar:
+        return MakeTypedKernel<std::uint8_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeShort:
+        return MakeTypedKernel<std::int16_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeChar:
+        return MakeTypedKernel<std::int8_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeUShort:
+        return MakeTypedKernel<std::uint16_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeInt:
+        return MakeTypedKernel<std::int32_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeUInt:
+        return MakeTypedKernel<std::uint32_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeLongLong:
+        return MakeTypedKernel<std::int64_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeULongLong:
+        return MakeTypedKernel<std::uint64_t, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeFloat:
+        return MakeTypedKernel<float, Counter>(min, max, bins);
+    case PAYLOAD_TYPE::TypeDouble:
+        return MakeTypedKernel<double, Counter>(min, max, bins);
+    }
+    return nullptr;
+}
+
+
+/*
+ * Histograms far bigger than L2 (millions of bins, or 65536 bins per worker times many workers)
+ * miss on nearly every increment. Two passes instead:
+ * 1. bin the voxels (Kernel<BinIndex>) and partition the bins by their high bits into buckets
+ *    that each cover an L2 sized run of counters. Every bucket has a cache line of pending bins
+ *    (software write combining): the partitioning writes stay in a few L1 lines and go out to the
+ *    bucket a full line at a time.
+ * 2. count every bucket on its own: all its increments land in the bucket's run of counters,
+ *    which stays in L2 while it is being counted. Buckets cover disjoint counters so they can be
+ *    counted in parallel into one shared histogram, no per worker copies to merge.
+ * A worker keeps its RadixPartition from round to round: fresh bucket memory costs a page fault
+ * per 4KB, as much as the partitioning itself.
+*/
+struct RadixPlan {
+    int shift = 0;              // bucket of bin b is b >> shift
+    std::size_t buckets = 0;
+};
+
+constexpr std::size_t MAX_RADIX_BUCKETS = 4096;
+
+/*
+ * false while the plain kernels are as fast: the partitioning costs ~4ns a voxel, which only pays
+ * once the per worker copies of the counters are ~16x L2 (single worker, SPR: even at 4M bins,
+ * 2x faster at 16M). With more workers the copies add up to that sooner, and radix needs just one.
+ * Never while the narrow local counters fit L2, each worker then counts in its own L2.
+*/
+inline bool PlanRadix(std::size_t bins, std::size_t counter_size, std::size_t workers, RadixPlan& plan){
+
+    const std::size_t l2 = RkUtil::CacheSize(2);
+    if (PickResidency(bins, counter_size) != Residency::Memory ||
+            bins * counter_size * std::max<std::size_t>(workers, 1) < 16 * l2){
+        return false;
+    }
+    const std::size_t run = l2 / 2 / counter_size;
+    plan.shift = 0;
+    while ((std::size_t(2) << plan.shift) <= run){
+        ++plan.shift;
+    }
+    while (((bins - 1) >> plan.shift) + 1 > MAX_RADIX_BUCKETS){
+        ++plan.shift;
+    }
+    plan.buckets = ((bins - 1) >> plan.shift) + 1;
+    return plan.buckets >= 2;
+}
+
+class RadixPartition
+{
+    static constexpr std::size_t LINE = 64 / sizeof(std::uint32_t);
+    struct alignas(64) Pending {
+        std::uint32_t bins[LINE];
+    };
+
+public:
+    explicit RadixPartition(const RadixPlan& plan)
+        : m_Shift(plan.shift),
+          m_Pending(plan.buckets),
+          m_Fill(plan.buckets, 0),
+          m_Buckets(plan.buckets),
+          m_Sizes(plan.buckets, 0),
+          m_Capacities(plan.buckets, 0) {}
+
+    // room for voxels spread evenly plus some slack, a skewed bucket grows on demand
+    void Reserve(std::size_t voxels){
+
+        const std::size_t even = voxels / m_Buckets.size();
+        for (std::size_t b = 0; b < m_Buckets.size(); ++b){
+            if (m_Capacities[b] < even + even / 8 + LINE){
+                Grow(b, even + even / 8 + LINE);
+            }
+        }
+    }
+
+    void Add(const BinIndex* bins, std::size_t n){
+
+        // raw pointers in locals: the stores below may not alias them, so they stay in registers
+        Pending* const pending = m_Pending.data();
+        std::uint32_t* const fills = m_Fill.data();
+        const int shift = m_Shift;
+        Dispatch([&]{
+            for (std::size_t i = 0; i < n; ++i){
+                const std::uint32_t bin = static_cast<std::uint32_t>(bins[i]);
+                const std::size_t b = bin >> shift;
+                const std::uint32_t fill = fills[b];
+                pending[b].bins[fill] = bin;
+                if (fill + 1 == LINE){
+                    Append(b, LINE);
+                    fills[b] = 0;
+                }else{
+                    fills[b] = fill + 1;
+                }
+            }
+        });
+    }
+
+    // empty again, keeps the (already faulted in) storage for the next round
+    void Clear(){
+
+        std::fill(m_Sizes.begin(), m_Sizes.end(), 0);
+        std::fill(m_Fill.begin(), m_Fill.end(), 0);
+    }
+
+    // pending bins to their buckets, call once done adding
+    void Flush(){
+
+        for (std::size_t b = 0; b < m_Buckets.size(); ++b){
+            Append(b, m_Fill[b]);
+            m_Fill[b] = 0;
+        }
+    }
+
+    std::string_view Bucket(std::size_t b) const{
+
+        return std::string_view(reinterpret_cast<const char*>(m_Buckets[b].get()), m_Sizes[b] * sizeof(std::uint32_t));
+    }
+
+private:
+    // uninitialised storage, every slot is written before it is read
+    void Grow(std::size_t b, std::size_t capacity){
+
+        std::unique_ptr<std::uint32_t[]> bigger(new std::uint32_t[capacity]);
+        if (m_Sizes[b]){
+            std::memcpy(bigger.get(), m_Buckets[b].get(), m_Sizes[b] * sizeof(std::uint32_t));
+        }
+        m_Buckets[b] = std::move(bigger);
+        m_Capacities[b] = capacity;
+    }
+
+    void Append(std::size_t b, std::size_t n){
+
+        if (m_Sizes[b] + n > m_Capacities[b]){
+            Grow(b, std::max<std::size_t>(2 * m_Capacities[b], m_Sizes[b] + LINE));
+        }
+        std::memcpy(m_Buckets[b].get() + m_Sizes[b], m_Pending[b].bins, n * sizeof(std::uint32_t));
+        m_Sizes[b] += n;
+    }
+
+    int m_Shift;
+    std::vector<Pending> m_Pending;
+    std::vector<std::uint32_t> m_Fill;
+    std::vector<std::unique_ptr<std::uint32_t[]>> m_Buckets;
+    std::vector<std::size_t> m_Sizes;
+    std::vector<std::size_t> m_Capacities;
+};
+
+// bins is a bucket of RadixPartition, a run of uint32 bin indices
+template<typename Counter>
+void CountBucket(const std::string_view& bins, Counter* hist){
+
+    const std::size_t n = bins.size() / sizeof(std::uint32_t);
+    Dispatch([&]{
+        for (std::size_t i = 0; i < n; ++i){
+            std::uint32_t bin;
+            std::memcpy(&bin, bins.data() + i * sizeof(std::uint32_t), sizeof(bin));
+            hist[bin] += 1;
+        }
+    });
+}
+
+/*
+ * Auto range (-min / -max left out): the data's own extent.
+ * 8 and 16 bit payloads are first counted per value over their whole domain (DomainBinning), the
+ * range is where the counts start and end and those few thousand counts are then rebinned, so the
+ * data is only read once. Wider payloads get a min / max scan first (RangeScanner).
+*/
+struct Range {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    bool Valid() const { return min <= max; }
+
+    void Merge(const Range& other){
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+using RangeScanner = std::function<void(const std::string_view& data, Range& range)>;
+
+template<typename T>
+void ScanRange(const std::string_view& data, Range& range){
+
+    // plain compare and select so the loop vectorises (pminsw / minps ...), NaN is skipped
+    T lo = std::is_floating_point_v<T> ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+    T hi = std::is_floating_point_v<T> ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    for (std::size_t idx = 0; idx < size; idx += sizeof(T)){
+        const T val = RkUtil::DecodeBytesSpcialized<T>(data, idx);
+        lo = val < lo ? val : lo;
+        hi = val > hi ? val : hi;
+    }
+    if (size && lo <= hi){
+        range.Merge(Range{static_cast<double>(lo), static_cast<double>(hi)});
+    }
+}
+
+// Bit pattern of a value with the sign flipped, i.e. v - lowest: counts in value order.
+template<typename T>
+struct DomainBinning {
+    std::size_t operator()(T v) const {
+        using U = std::make_unsigned_t<T>;
+        constexpr U BIAS = std::is_signed_v<T> ? U(U(1) << (8 * sizeof(T) - 1)) : U(0);
+        return static_cast<U>(static_cast<U>(v) ^ BIAS);
+    }
+};
+
+// Per value counting kernel for 8 and 16 bit payloads, nullptr for wider ones.
+template<typename Counter>
+Kernel<Counter> MakeDomainKernel(RkUtil::PAYLOAD_TYPE type, std::size_t& domain_size, double& lowest){
+
+    using RkUtil::PAYLOAD_TYPE;
+    switch (type) {
+    case PAYLOAD_TYPE::TypeUChar:
+        domain_size = 1 << 8;
+        lowest = 0;
+        return BinnedKernel<std::uint8_t, Counter>(DomainBinning<std::uint8_t>(), domain_size);
+    case PAYLOAD_TYPE::TypeChar:
+        domain_size = 1 << 8;
+        lowest = std::numeric_limits<std::int8_t>::lowest();
+        return BinnedKernel<std::int8_t, Counter>(DomainBinning<std::int8_t>(), domain_size);
+    case PAYLOAD_TYPE::TypeShort:
+        domain_size = 1 << 16;
+        lowest = std::numeric_limits<std::int16_t>::lowest();
+        return BinnedKernel<std::int16_t, Counter>(DomainBinning<std::int16_t>(), domain_size);
+    case PAYLOAD_TYPE::TypeUShort:
+        domain_size = 1 << 16;
+        lowest = 0;
+        return BinnedKernel<std::uint16_t, Counter>(DomainBinning<std::uint16_t>(), domain_size);
+    default:
+        break;
+    }
+    return nullptr;
+}
+
+template<typename T, template<typename, ClampPolicy> class Binning>
+bool FillDomainBins(const Range& range, std::size_t bins, std::vector<std::uint32_t>& out){
+
+    using U = std::make_unsigned_t<T>;
+    Binning<T, ClampPolicy::Clamp> binning;
+    if (!Binning<T, ClampPolicy::Clamp>::Make(range.min, range.max, bins, binning)){
+        return false;
+    }
+    constexpr U BIAS = std::is_signed_v<T> ? U(U(1) << (8 * sizeof(T) - 1)) : U(0);
+    out.resize(std::size_t(std::numeric_limits<U>::max()) + 1);
+    for (std::size_t u = 0; u < out.size(); ++u){
+        out[u] = static_cast<std::uint32_t>(binning(static_cast<T>(static_cast<U>(u ^ BIAS))));
+    }
+    return true;
+}
+
+template<typename T>
+std::vector<std::uint32_t> TypedDomainBins(const Range& range, std::size_t bins){
+
+    std::vector<std::uint32_t> out;
+    if (!FillDomainBins<T, FixedPointBinning>(range, bins, out)){
+        FillDomainBins<T, ScaledBinning>(range, bins, out);
+    }
+    return out;
+}
+
+// Bin of every DomainBinning index of an 8 / 16 bit type, empty if the range cannot be binned.
+inline std::vector<std::uint32_t> DomainBins(RkUtil::PAYLOAD_TYPE type, const Range& range, std::size_t bins){
+
+    using RkUtil::PAYLOAD_TYPE;
+    switch (type) {
+    case PAYLOAD_TYPE::TypeUChar:
+        return TypedDomainBins<std::uint8_t>(range, bins);
+    case PAYLOAD_TYPE::TypeChar:
+        return TypedDomainBins<std::int8_t>(range, bins);
+    case PAYLOAD_TYPE::TypeShort:
+        return TypedDomainBins<std::int16_t>(range, bins);
+    case PAYLOAD_TYPE::TypeUShort:
+        return TypedDomainBins<std::uint16_t>(range, bins);
+    default:
+        break;
+    }
+    return {};
+}
+
+template<typename T>
+void DispatchedScanner(const std::string_view& data, Range& range){
+
+    Dispatch([&]{ ScanRange<T>(data, range); });
+}
+
+inline RangeScanner MakeRangeScanner(RkUtil::PAYLOAD_TYPE type){
+
+    using RkUtil::PAYLOAD_TYPE;
+    switch (type) {
+    case PAYLOAD_TYPE::TypeUChar:
+        return DispatchedScanner<std::uint8_t>;
+    case PAYLOAD_TYPE::TypeShort:
+        return DispatchedScanner<std::int16_t>;
+    case PAYLOAD_TYPE::TypeChar:
+        return DispatchedScanner<std::int8_t>;
+    case PAYLOAD_TYPE::TypeUShort:
+        return DispatchedScanner<std::uint16_t>;
+    case PAYLOAD_TYPE::TypeInt:
+        return DispatchedScanner<std::int32_t>;
+    case PAYLOAD_TYPE::TypeUInt:
+        return DispatchedScanner<std::uint32_t>;
+    case PAYLOAD_TYPE::TypeLongLong:
+        return DispatchedScanner<std::int64_t>;
+    case PAYLOAD_TYPE::TypeULongLong:
+        return DispatchedScanner<std::uint64_t>;
+    case PAYLOAD_TYPE::TypeFloat:
+        return DispatchedScanner<float>;
+    case PAYLOAD_TYPE::TypeDouble:
+        return DispatchedScanner<double>;
+    }
+    return nullptr;
+}
+
+
+/*
+ * dst[i] += srcs[0][i] + ... + srcs[count - 1][i] for i < n. Meant for blocks of dst that stay in L1
+ * while the sources stream past. Four sources a pass, one a pass spends as much on the loads and
+ * stores of dst as on the sources. 1M uint64 bins x 32 partials, one thread: 34ms, 60ms pairwise.
+*/
+template<typename Counter>
+void SumCounts(Counter* dst, const Counter* const* srcs, std::size_t count, std::size_t n){
+
+    Dispatch([&]{
+        std::size_t s = 0;
+        for (; s + 4 <= count; s += 4){
+            const Counter* a = srcs[s];
+            const Counter* b = srcs[s + 1];
+            const Counter* c = srcs[s + 2];
+            const Counter* d = srcs[s + 3];
+            for (std::size_t i = 0; i < n; ++i){
+                dst[i] += (a[i] + b[i]) + (c[i] + d[i]);
+            }
+        }
+        for (; s < count; ++s){
+            const Counter* a = srcs[s];
+            for (std::size_t i = 0; i < n; ++i){
+                dst[i] += a[i];
+            }
+        }
+    });
+}
+
+/*
+ * Payloads written on a machine of the other endianness (NRRD "endian: big" on x86).
+ * ByteSwap reverses each width byte wide element of src into dst; the swapping kernel / scanner
+ * wrappers feed the kernels swapped copies of a slice, a block at a time so the copy stays in L2.
+*/
+template<typename U>
+void ByteSwapTyped(const char* src, char* dst, std::size_t count){
+
+    for (std::size_t i = 0; i < count; ++i){
+        U v;
+        std::memcpy(&v, src + i * sizeof(U), sizeof(U));
+        if constexpr (sizeof(U) == 2){
+            v = __builtin_bswap16(v);
+        }else if constexpr (sizeof(U) == 4){
+            v = __builtin_bswap32(v);
+        }else{
+            v = __builtin_bswap64(v);
+        }
+        std::memcpy(dst + i * sizeof(U), &v, sizeof(U));
+    }
+}
+
+inline void ByteSwap(const char* src, char* dst, std::size_t bytes, std::size_t width){
+
+    const std::size_t count = bytes / width;
+    Dispatch([&]{
+        switch (width){
+        case 2: ByteSwapTyped<std::uint16_t>(src, dst, count); break;
+        case 4: ByteSwapTyped<std::uint32_t>(src, dst, count); break;
+        case 8: ByteSwapTyped<std::uint64_t>(src, dst, count); break;
+        default: std::memcpy(dst, src, count * width); break;
+        }
+    });
+}
+
+constexpr std::size_t SWAP_BLOCK = 64 << 10;
+
+template<typename F>
+void Swapped(const std::string_view& data, std::size_t width, F&& f){
+
+    alignas(64) char block[SWAP_BLOCK];
+    const std::size_t step = SWAP_BLOCK - (SWAP_BLOCK % width);
+    for (std::size_t pos = 0; pos < data.size(); pos += step){
+        const std::size_t n = std::min(step, data.size() - pos);
+        ByteSwap(data.data() + pos, block, n, width);
+        f(std::string_view(block, n));
+    }
+}
+
+template<typename Counter>
+Kernel<Counter> SwapKernel(Kernel<Counter> kernel, std::size_t width){
+
+    return [kernel = std::move(kernel), width](const std::string_view& data, Counter* hist){
+        Swapped(data, width, [&](const std::string_view& block){
+            kernel(block, hist);
+            if constexpr (std::is_same_v<Counter, BinIndex>){
+                hist += block.size() / width;
+            }
+        });
+    };
+}
+
+inline RangeScanner SwapScanner(RangeScanner scanner, std::size_t width){
+
+    return [scanner = std::move(scanner), width](const std::string_view& data, Range& range){
+        Swapped(data, width, [&](const std::string_view& block){ scanner(block, range); });
+    };
+}
+
+}
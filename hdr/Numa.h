@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace RkUtil {
+
+/*
+ * NUMA topology as sysfs reports it plus the two mempolicy syscalls the histogram needs, no
+ * libnuma. Only cpus in the affinity mask are listed and only nodes with some of those count,
+ * memory only nodes never run a worker. On a single node host, or where sysfs / the syscalls are
+ * missing, everything is node 0 and nothing is placed.
+ *
+ * Workers are split over the nodes in equal runs, worker w of n on node NodeOfWorker(w, n, nodes):
+ * the pool pins its threads that way and Schedule() deals out its states the same way.
+*/
+class Numa
+{
+public:
+    static const Numa& Topology(){
+
+        static const Numa numa;
+        return numa;
+    }
+
+    std::size_t Nodes() const { return m_Cpus.size(); }
+
+    const std::vector<int>& Cpus(std::size_t node) const { return m_Cpus[node]; }
+
+    static std::size_t NodeOfWorker(std::size_t worker, std::size_t workers, std::size_t nodes){
+
+        return worker * nodes / std::max<std::size_t>(workers, 1);
+    }
+
+    // first worker on node, workers when node == nodes
+    static std::size_t FirstWorker(std::size_t node, std::size_t workers, std::size_t nodes){
+
+        return (node * workers + nodes - 1) / std::max<std::size_t>(nodes, 1);
+    }
+
+    // node the calling thread runs on right now
+    std::size_t ThisNode() const{
+
+        if (Nodes() < 2){
+            return 0;
+        }
+        const int cpu = sched_getcpu();
+        return (cpu >= 0 && std::size_t(cpu) < m_NodeOfCpu.size()) ? m_NodeOfCpu[cpu] : 0;
+    }
+
+    // node holding the (already touched) page at p
+    std::size_t NodeOf(const void* p) const{
+
+        if (Nodes() < 2){
+            return 0;
+        }
+        int id = -1;
+        if (syscall(SYS_get_mempolicy, &id, nullptr, 0, p, MPOL_F_NODE | MPOL_F_ADDR) != 0){
+            return 0;
+        }
+        const auto itr = std::find(m_Ids.begin(), m_Ids.end(), id);
+        return itr == m_Ids.end() ? 0 : itr - m_Ids.begin();
+    }
+
+    // the whole pages of [p, p + len) fault in on node, whichever thread touches them first
+    void Bind(void* p, std::size_t len, std::size_t node) const{
+
+        if (Nodes() < 2){
+            return;
+        }
+        const std::uintptr_t lo = (reinterpret_cast<std::uintptr_t>(p) + m_Page - 1) & ~(m_Page - 1);
+        const std::uintptr_t hi = (reinterpret_cast<std::uintptr_t>(p) + len) & ~(m_Page - 1);
+        if (hi <= lo){
+            return;
+        }
+        const int id = m_Ids[node];
+        std::vector<unsigned long> mask(id / 64 + 1, 0);
+        mask[id / 64] |= 1ul << (id % 64);
+        // preferred, not bound: a full node spills over rather than failing the fault.
+        // The kernel reads maxnode - 1 bits.
+        syscall(SYS_mbind, lo, hi - lo, MPOL_PREFERRED, mask.data(), mask.size() * 64 + 1, 0);
+    }
+
+    // [p, p + len) cut into Nodes() runs of whole pages, the k-th bound to node k
+    void Spread(void* p, std::size_t len) const{
+
+        const std::size_t nodes = Nodes();
+        const std::size_t run = (len / nodes + m_Page - 1) & ~(m_Page - 1);
+        for (std::size_t node = 0; node < nodes && node * run < len; ++node){
+            Bind(static_cast<char*>(p) + node * run, std::min(run, len - node * run), node);
+        }
+    }
+
+    // calling thread runs only on the cpus of node from here on
+    void PinToNode(std::size_t node) const{
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : m_Cpus[node]){
+            CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    // "0-3,8-11\n" -> 0 1 2 3 8 9 10 11
+    static std::vector<int> ParseList(const std::string& list){
+
+        std::vector<int> ids;
+        std::stringstream ss(list);
+        for (std::string range; std::getline(ss, range, ','); ){
+            int lo, hi;
+            const int n = std::sscanf(range.c_str(), "%d-%d", &lo, &hi);
+            if (n < 1 || lo < 0){
+                continue;
+            }
+            for (int id = lo; id <= (n == 2 ? hi : lo); ++id){
+                ids.push_back(id);
+            }
+        }
+        return ids;
+    }
+
+private:
+    Numa(){
+
+        const long page = sysconf(_SC_PAGESIZE);
+        m_Page = page > 0 ? page : 4096;
+
+        // only the cpus this process may run on (taskset, cgroup cpuset)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+                CPU_SET(cpu, &allowed);
+            }
+        }
+        for (int id : ParseList(ReadLine("/sys/devices/system/node/online"))){
+            std::vector<int> cpus = ParseList(ReadLine("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"));
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&allowed](int cpu){
+                return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed);
+            }), cpus.end());
+            if (cpus.empty()){
+                continue;
+            }
+            for (int cpu : cpus){
+                if (std::size_t(cpu) >= m_NodeOfCpu.size()){
+                    m_NodeOfCpu.resize(cpu + 1, 0);
+                }
+                m_NodeOfCpu[cpu] = m_Cpus.size();
+            }
+            m_Ids.push_back(id);
+            m_Cpus.push_back(std::move(cpus));
+        }
+        if (m_Cpus.empty()){
+            m_Ids.assign(1, 0);
+            m_Cpus.emplace_back();
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+                if (CPU_ISSET(cpu, &allowed)){
+                    m_Cpus[0].push_back(cpu);
+                }
+            }
+        }
+    }
+
+    static std::string ReadLine(const std::string& path){
+
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    std::size_t m_Page;
+    // sysfs node ids, dense index -> id
+    std::vector<int> m_Ids;
+    std::vector<std::vector<int>> m_Cpus;
+    std::vector<std::size_t> m_NodeOfCpu;
+};
+
+}
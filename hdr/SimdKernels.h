@@ -0,0 +1,224 @@
+#pragma once
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/*
+ * Runtime ISA dispatch. The build targets baseline x86-64 (SSE2) so one binary runs on the whole
+ * fleet; the hot loops are additionally compiled for x86-64-v3 (Haswell: AVX2, BMI2, FMA) and
+ * x86-64-v4 (Skylake-SP on: AVX-512 F/BW/CD/DQ/VL) and the variant is picked once, at startup,
+ * from cpuid or from --kernel.
+ *
+ * Target<I>::Run(f) is where a variant comes from: it is compiled for I and flattened, so f and
+ * everything f calls (decode, binning, increments) is inlined into it and compiled for I as well.
+ * Dispatch(f) calls the one for the selected ISA.
+ *
+ * On top of that there are hand written loops for the 16 bit table lookup kernel (LookupBinning in
+ * Kernels.h) when its histogram is past L1; 8 bit payloads and L1 histograms run the scalar sub
+ * histogram loops, which measured faster. A step loads 16 (AVX-512) or 8 (AVX2) voxels, zero
+ * extends them to 32 bit lanes, which is the table index (the unsigned bit pattern), and gathers
+ * the bins from the table. Clamping is baked into the table entries so it costs nothing here.
+ *
+ * The increments differ:
+ * AVX-512 - gather the counters, add 1 + number of earlier lanes with the same bin (vpconflictd and
+ *           a popcount) and scatter back. Scatter writes overlapping lanes in lane order, so the
+ *           last lane of a bin, the one carrying the full count, is the one that sticks.
+ * AVX2    - no scatter: the gathered bins are stored and the 8 counters incremented one by one.
+ *           Lane private copies of the histogram would avoid nothing here, at 8x a histogram
+ *           already past L1 they would not stay in cache.
+ *
+ * Tables with uint16 entries are gathered 32 bits at a time and masked, LookupBinning pads the table
+ * by one entry so the last one can be read that way.
+*/
+namespace RkKernels {
+
+enum class Isa : std::uint8_t {
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+inline const char* IsaName(Isa isa){
+
+    switch (isa){
+    case Isa::Avx512: return "avx512";
+    case Isa::Avx2: return "avx2";
+    case Isa::Scalar: break;
+    }
+    return "scalar";
+}
+
+inline bool ParseIsa(const std::string& name, Isa& isa){
+
+    for (const Isa i : {Isa::Scalar, Isa::Avx2, Isa::Avx512}){
+        if (name == IsaName(i)){
+            isa = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Best variant this CPU can run.
+inline Isa DetectIsa(){
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512dq") &&
+            __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma")){
+        return Isa::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma")){
+        return Isa::Avx2;
+    }
+    return Isa::Scalar;
+}
+
+inline Isa& SelectedIsa(){
+
+    static Isa isa = DetectIsa();
+    return isa;
+}
+
+// Variant the kernels made from here on run. Set before any kernel is made.
+inline Isa ActiveIsa(){ return SelectedIsa(); }
+
+inline void SelectIsa(Isa isa){ SelectedIsa() = isa; }
+
+template<Isa I>
+struct Target;
+
+template<>
+struct Target<Isa::Scalar> {
+    template<typename F>
+    static void Run(F&& f){ f(); }
+};
+
+template<>
+struct Target<Isa::Avx2> {
+    template<typename F>
+    __attribute__((flatten, target("arch=x86-64-v3")))
+    static void Run(F&& f){ f(); }
+};
+
+template<>
+struct Target<Isa::Avx512> {
+    template<typename F>
+    __attribute__((flatten, target("arch=x86-64-v4")))
+    static void Run(F&& f){ f(); }
+};
+
+template<typename F>
+void Dispatch(F&& f){
+
+    switch (ActiveIsa()){
+    case Isa::Avx512:
+        Target<Isa::Avx512>::Run(f);
+        return;
+    case Isa::Avx2:
+        Target<Isa::Avx2>::Run(f);
+        return;
+    case Isa::Scalar:
+        break;
+    }
+    Target<Isa::Scalar>::Run(f);
+}
+
+// Set bits per 32 / 64 bit lane with AVX-512BW only (vpopcntd is Ice Lake on): nibble table.
+__attribute__((target("arch=x86-64-v4")))
+inline __m512i PopcountBytes(__m512i x){
+
+    const __m512i table = _mm512_set4_epi32(0x04030302, 0x03020201, 0x03020201, 0x02010100);
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    const __m512i lo = _mm512_shuffle_epi8(table, _mm512_and_si512(x, nibble));
+    const __m512i hi = _mm512_shuffle_epi8(table, _mm512_and_si512(_mm512_srli_epi16(x, 4), nibble));
+    return _mm512_add_epi8(lo, hi);
+}
+
+__attribute__((target("arch=x86-64-v4")))
+inline __m512i Popcount32(__m512i x){
+
+    const __m512i pairs = _mm512_maddubs_epi16(PopcountBytes(x), _mm512_set1_epi8(1));
+    return _mm512_madd_epi16(pairs, _mm512_set1_epi16(1));
+}
+
+__attribute__((target("arch=x86-64-v4")))
+inline __m512i Popcount64(__m512i x){
+
+    return _mm512_sad_epu8(PopcountBytes(x), _mm512_setzero_si512());
+}
+
+template<typename T, typename Counter, typename Index>
+inline void AccumulateTail(const std::string_view& data, std::size_t idx, Counter* hist, const Index* table){
+
+    const std::size_t size = data.size() - (data.size() % sizeof(T));
+    for (; idx < size; idx += sizeof(T)){
+        std::make_unsigned_t<T> u;
+        std::memcpy(&u, data.data() + idx, sizeof(T));
+        hist[table[u]] += 1;
+    }
+}
+
+template<typename T, typename Counter, typename Index>
+__attribute__((target("arch=x86-64-v4")))
+void AccumulateAvx512(const std::string_view& data, Counter* hist, const Index* table){
+
+    static_assert(sizeof(T) == 2 && (sizeof(Counter) == 4 || sizeof(Counter) == 8));
+    constexpr std::size_t STEP = 16 * sizeof(T);
+    const std::size_t body = data.size() - (data.size() % STEP);
+    const char* p = data.data();
+
+    for (std::size_t idx = 0; idx < body; idx += STEP){
+        const __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + idx)));
+        __m512i b = _mm512_i32gather_epi32(v, table, sizeof(Index));
+        if constexpr (sizeof(Index) == 2){
+            b = _mm512_and_si512(b, _mm512_set1_epi32(0xFFFF));
+        }
+        if constexpr (sizeof(Counter) == 4){
+            const __m512i inc = _mm512_add_epi32(Popcount32(_mm512_conflict_epi32(b)), _mm512_set1_epi32(1));
+            const __m512i old = _mm512_i32gather_epi32(b, hist, 4);
+            _mm512_i32scatter_epi32(hist, b, _mm512_add_epi32(old, inc), 4);
+        }else{
+            // 64 bit counters, two rounds of 8 lanes
+            const __m256i halves[2] = {_mm512_castsi512_si256(b), _mm512_extracti64x4_epi64(b, 1)};
+            for (const __m256i& h : halves){
+                const __m512i w = _mm512_cvtepu32_epi64(h);
+                const __m512i inc = _mm512_add_epi64(Popcount64(_mm512_conflict_epi64(w)), _mm512_set1_epi64(1));
+                const __m512i old = _mm512_i32gather_epi64(h, hist, 8);
+                _mm512_i32scatter_epi64(hist, h, _mm512_add_epi64(old, inc), 8);
+            }
+        }
+    }
+    AccumulateTail<T, Counter>(data, body, hist, table);
+}
+
+template<typename T, typename Counter, typename Index>
+__attribute__((target("arch=x86-64-v3")))
+void AccumulateAvx2(const std::string_view& data, Counter* hist, const Index* table){
+
+    static_assert(sizeof(T) == 2);
+    constexpr std::size_t LANES = 8;
+    constexpr std::size_t STEP = LANES * sizeof(T);
+    const std::size_t body = data.size() - (data.size() % STEP);
+    const char* p = data.data();
+    alignas(32) std::uint32_t out[LANES];
+
+    for (std::size_t idx = 0; idx < body; idx += STEP){
+        const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + idx)));
+        __m256i b = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), v, sizeof(Index));
+        if constexpr (sizeof(Index) == 2){
+            b = _mm256_and_si256(b, _mm256_set1_epi32(0xFFFF));
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out), b);
+        for (std::size_t k = 0; k < LANES; ++k){
+            hist[out[k]] += 1;
+        }
+    }
+    AccumulateTail<T, Counter>(data, body, hist, table);
+}
+
+}
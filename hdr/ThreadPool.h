@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../hdr/Numa.h"
+
+namespace RkUtil {
+
+/*
+ * Fixed set of worker threads, started once and fed from one FIFO. Replaces a std::async thread
+ * per slice / merge / decode helper: a thread costs ~20us to create and join, a queued task a
+ * lock, a push and (only if a worker sleeps) a notify.
+ *
+ * Tasks must not wait on other tasks of the pool: with every worker waiting nobody is left to run
+ * what they wait for. Parallel() and ParallelFor() are built so they never do, the calling thread
+ * takes part and helpers that get to run too late have nothing left to wait for.
+*/
+class ThreadPool
+{
+public:
+    // start(t) runs first thing on worker t, e.g. to pin it
+    explicit ThreadPool(std::size_t threads, std::function<void(std::size_t)> start = nullptr){
+
+        for (std::size_t t = 0; t < std::max<std::size_t>(threads, 1); ++t){
+            m_Threads.emplace_back([this, t, start]{
+                if (start){
+                    start(t);
+                }
+                Loop();
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // runs what is queued, then joins
+    ~ThreadPool(){
+
+        {
+            std::lock_guard<std::mutex> lk(m_Guard);
+            m_Stop = true;
+        }
+        m_Wake.notify_all();
+        for (std::thread& t : m_Threads){
+            t.join();
+        }
+    }
+
+    std::size_t Size() const { return m_Threads.size(); }
+
+    template<typename F>
+    std::future<std::invoke_result_t<F&>> Submit(F&& f){
+
+        using R = std::invoke_result_t<F&>;
+        // std::function wants a copyable callable, packaged_task is move only
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> fu = task->get_future();
+        Post([task]{ (*task)(); });
+        return fu;
+    }
+
+    /*
+     * f on the calling thread and on up to threads - 1 workers at once, f being a loop which takes
+     * its work from something shared (an atomic index). Returns when the caller's f did and the
+     * helpers which had started are done; those which had not by then skip f.
+    */
+    template<typename F>
+    void Parallel(std::size_t threads, F&& f){
+
+        struct Gate {
+            std::mutex guard;
+            std::condition_variable done;
+            std::size_t running = 0;
+            bool closed = false;
+        };
+        auto gate = std::make_shared<Gate>();
+        for (std::size_t t = 1; t < threads; ++t){
+            Post([gate, &f]{
+                {
+                    std::lock_guard<std::mutex> lk(gate->guard);
+                    if (gate->closed){
+                        return;
+                    }
+                    ++gate->running;
+                }
+                f();
+                std::lock_guard<std::mutex> lk(gate->guard);
+                if (--gate->running == 0){
+                    gate->done.notify_all();
+                }
+            });
+        }
+        f();
+        std::unique_lock<std::mutex> lk(gate->guard);
+        gate->closed = true;
+        gate->done.wait(lk, [&gate]{ return gate->running == 0; });
+    }
+
+    // body(0) .. body(count - 1) on up to 'threads' threads, the calling one included.
+    void ParallelFor(std::size_t threads, std::size_t count, const std::function<void(std::size_t)>& body){
+
+        std::atomic<std::size_t> next{0};
+        Parallel(std::min(std::max<std::size_t>(threads, 1), count), [&]{
+            for (std::size_t i; (i = next++) < count; ){
+                body(i);
+            }
+        });
+    }
+
+    /*
+     * body(node, i) for every i < counts[node] of every node, on up to 'threads' threads. A thread
+     * takes the items of the NUMA node it runs on first and helps with the other nodes' after.
+    */
+    void ParallelForNodes(std::size_t threads, const std::vector<std::size_t>& counts,
+                          const std::function<void(std::size_t, std::size_t)>& body){
+
+        const std::size_t nodes = counts.size();
+        std::unique_ptr<std::atomic<std::size_t>[]> next(new std::atomic<std::size_t>[nodes]);
+        std::size_t total = 0;
+        for (std::size_t n = 0; n < nodes; ++n){
+            next[n] = 0;
+            total += counts[n];
+        }
+        Parallel(std::min(std::max<std::size_t>(threads, 1), total), [&]{
+            const std::size_t home = Numa::Topology().ThisNode();
+            for (std::size_t k = 0; k < nodes; ++k){
+                const std::size_t n = (home + k) % nodes;
+                for (std::size_t i; (i = next[n]++) < counts[n]; ){
+                    body(n, i);
+                }
+            }
+        });
+    }
+
+private:
+    void Post(std::function<void()> job){
+
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lk(m_Guard);
+            m_Jobs.push_back(std::move(job));
+            // a worker already woken for an earlier job will find this one as well
+            wake = m_Jobs.size() <= m_Idle;
+        }
+        if (wake){
+            m_Wake.notify_one();
+        }
+    }
+
+    void Loop(){
+
+        std::unique_lock<std::mutex> lk(m_Guard);
+        for (;;){
+            if (m_Jobs.empty()){
+                if (m_Stop){
+                    return;
+                }
+                ++m_Idle;
+                m_Wake.wait(lk, [this]{ return m_Stop || !m_Jobs.empty(); });
+                --m_Idle;
+                continue;
+            }
+            std::function<void()> job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+            lk.unlock();
+            job();
+            lk.lock();
+        }
+    }
+
+    std::mutex m_Guard;
+    std::condition_variable m_Wake;
+    std::deque<std::function<void()>> m_Jobs;
+    std::size_t m_Idle = 0;
+    bool m_Stop = false;
+    std::vector<std::thread> m_Threads;
+};
+
+/*
+ * Work stealing: one deque of items per worker. A worker takes from the front of its own and, once
+ * that is empty, from the back of the others', i.e. from the far end of the run their owner works
+ * through. A worker that got slow slices or a noisy neighbour then just ends up doing less.
+ * Items are expected to be coarse (a chunk of voxels), a lock per deque is cheap next to them.
+ * With groups (NUMA nodes, workers split as Numa::NodeOfWorker does) a worker steals within its
+ * own group before it reaches over to another.
+*/
+template<typename T>
+class StealingQueues
+{
+public:
+    explicit StealingQueues(std::size_t workers, std::size_t groups = 1)
+        : m_Queues(std::max<std::size_t>(workers, 1)),
+          m_Groups(std::min(std::max<std::size_t>(groups, 1), m_Queues.size())) {}
+
+    std::size_t Workers() const { return m_Queues.size(); }
+
+    void Push(std::size_t worker, T item){
+
+        Queue& q = m_Queues[worker];
+        std::lock_guard<std::mutex> lk(q.guard);
+        q.items.push_back(std::move(item));
+    }
+
+    // false once every deque is empty
+    bool Pop(std::size_t worker, T& item){
+
+        const std::size_t n = m_Queues.size();
+        const std::size_t group = Numa::NodeOfWorker(worker, n, m_Groups);
+        const std::size_t first = Numa::FirstWorker(group, n, m_Groups);
+        const std::size_t last = Numa::FirstWorker(group + 1, n, m_Groups);
+        // own deque, the rest of the group, then everybody else
+        for (std::size_t k = 0; k < n; ++k){
+            const std::size_t w = k < last - first ? first + (worker - first + k) % (last - first)
+                                                   : (last + k - (last - first)) % n;
+            Queue& q = m_Queues[w];
+            std::lock_guard<std::mutex> lk(q.guard);
+            if (q.items.empty()){
+                continue;
+            }
+            if (k == 0){
+                item = std::move(q.items.front());
+                q.items.pop_front();
+            }else{
+                item = std::move(q.items.back());
+                q.items.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    // own cache line each, the owners hammer their own lock
+    struct alignas(64) Queue {
+        std::mutex guard;
+        std::deque<T> items;
+    };
+    std::vector<Queue> m_Queues;
+    std::size_t m_Groups;
+};
+
+}
@@ -3,31 +3,156 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_set>
+#include <atomic>
+#include <unordered_map>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 #include <boost/algorithm/string/trim.hpp>
 
+#include "../hdr/Numa.h"
+
 namespace RkUtil {
 
-const int MAX_HIST_BIN_SIZE = 300;
+// bin buffers up to this many entries live inline in the pooled object, bigger ones go to the heap
+const int INLINE_HIST_BIN_SIZE = 300;
+// upper bound on --bins, 16M bins is 64MB of uint32 per worker copy (plus 128MB of uint64 totals)
+const std::size_t MAX_HIST_BIN_SIZE = std::size_t(1) << 24;
 
 enum class PAYLOAD_TYPE {
     TypeUChar = 0,
-    TypeShort
+    TypeShort,
+    TypeChar,
+    TypeUShort,
+    TypeInt,
+    TypeUInt,
+    TypeLongLong,
+    TypeULongLong,
+    TypeFloat,
+    TypeDouble
 };
 
 const std::size_t PAYLOAD_TYPE_SIZE[] = {
     sizeof(char),
     sizeof(short),
+    sizeof(std::int8_t),
+    sizeof(std::uint16_t),
+    sizeof(std::int32_t),
+    sizeof(std::uint32_t),
+    sizeof(std::int64_t),
+    sizeof(std::uint64_t),
+    sizeof(float),
+    sizeof(double),
 };
 
+// every spelling the NRRD spec allows for the "type:" field
+// ref: http://teem.sourceforge.net/nrrd/format.html#type
 static std::map<std::string, PAYLOAD_TYPE> PayLoadType = {
+    {"UCHAR", PAYLOAD_TYPE::TypeUChar},
     {"UNSIGNED CHAR", PAYLOAD_TYPE::TypeUChar},
-    {"SHORT", PAYLOAD_TYPE::TypeShort}
+    {"UINT8", PAYLOAD_TYPE::TypeUChar},
+    {"UINT8_T", PAYLOAD_TYPE::TypeUChar},
+    {"SHORT", PAYLOAD_TYPE::TypeShort},
+    {"SHORT INT", PAYLOAD_TYPE::TypeShort},
+    {"SIGNED SHORT", PAYLOAD_TYPE::TypeShort},
+    {"SIGNED SHORT INT", PAYLOAD_TYPE::TypeShort},
+    {"INT16", PAYLOAD_TYPE::TypeShort},
+    {"INT16_T", PAYLOAD_TYPE::TypeShort},
+    {"SIGNED CHAR", PAYLOAD_TYPE::TypeChar},
+    {"INT8", PAYLOAD_TYPE::TypeChar},
+    {"INT8_T", PAYLOAD_TYPE::TypeChar},
+    {"USHORT", PAYLOAD_TYPE::TypeUShort},
+    {"UNSIGNED SHORT", PAYLOAD_TYPE::TypeUShort},
+    {"UNSIGNED SHORT INT", PAYLOAD_TYPE::TypeUShort},
+    {"UINT16", PAYLOAD_TYPE::TypeUShort},
+    {"UINT16_T", PAYLOAD_TYPE::TypeUShort},
+    {"INT", PAYLOAD_TYPE::TypeInt},
+    {"SIGNED INT", PAYLOAD_TYPE::TypeInt},
+    {"INT32", PAYLOAD_TYPE::TypeInt},
+    {"INT32_T", PAYLOAD_TYPE::TypeInt},
+    {"UINT", PAYLOAD_TYPE::TypeUInt},
+    {"UNSIGNED INT", PAYLOAD_TYPE::TypeUInt},
+    {"UINT32", PAYLOAD_TYPE::TypeUInt},
+    {"UINT32_T", PAYLOAD_TYPE::TypeUInt},
+    {"LONGLONG", PAYLOAD_TYPE::TypeLongLong},
+    {"LONG LONG", PAYLOAD_TYPE::TypeLongLong},
+    {"LONG LONG INT", PAYLOAD_TYPE::TypeLongLong},
+    {"SIGNED LONG LONG", PAYLOAD_TYPE::TypeLongLong},
+    {"SIGNED LONG LONG INT", PAYLOAD_TYPE::TypeLongLong},
+    {"INT64", PAYLOAD_TYPE::TypeLongLong},
+    {"INT64_T", PAYLOAD_TYPE::TypeLongLong},
+    {"ULONGLONG", PAYLOAD_TYPE::TypeULongLong},
+    {"UNSIGNED LONG LONG", PAYLOAD_TYPE::TypeULongLong},
+    {"UNSIGNED LONG LONG INT", PAYLOAD_TYPE::TypeULongLong},
+    {"UINT64", PAYLOAD_TYPE::TypeULongLong},
+    {"UINT64_T", PAYLOAD_TYPE::TypeULongLong},
+    {"FLOAT", PAYLOAD_TYPE::TypeFloat},
+    {"DOUBLE", PAYLOAD_TYPE::TypeDouble}
+};
+
+// Decoded payload bytes handed from the encoders to the histogram workers.
+// Either owns its storage (inflated data) or borrows it from a read-only file
+// mapping (raw data); the owner handle keeps the backing memory alive as long
+// as any slice still points into it, so no copy is needed to hand it over.
+class PayloadSlice
+{
+public:
+    PayloadSlice() = default;
+
+    explicit PayloadSlice(std::string&& bytes){
+
+        auto owned = std::make_shared<std::string>(std::move(bytes));
+        m_View = std::string_view(owned->data(), owned->size());
+        m_Owner = std::move(owned);
+    }
+
+    PayloadSlice(std::shared_ptr<const void> owner, const char* data, std::size_t size)
+        : m_Owner(std::move(owner)),
+          m_View(data, size) {}
+
+    // Uninitialised heap storage for decoders which overwrite every byte anyway.
+    // On a NUMA host its pages are placed before the decoder first touches them, which would put
+    // them all on the decoding thread's node: a big buffer is spread in runs over the nodes, smaller
+    // ones go to the nodes in turn. Schedule() hands every chunk to the workers of its node.
+    static std::shared_ptr<char[]> AllocateBuffer(std::size_t size){
+
+        const Numa& numa = Numa::Topology();
+        if (numa.Nodes() < 2){
+            return std::shared_ptr<char[]>(new char[size]);
+        }
+        const std::size_t page = sysconf(_SC_PAGESIZE);
+        char* data = static_cast<char*>(std::aligned_alloc(page, (size + page - 1) / page * page));
+        if (!data){
+            throw std::bad_alloc();
+        }
+        if (size >= numa.Nodes() * NUMA_SPREAD_RUN){
+            numa.Spread(data, size);
+        }else{
+            static std::atomic<std::size_t> next{0};
+            numa.Bind(data, size, next++ % numa.Nodes());
+        }
+        return std::shared_ptr<char[]>(data, [](char* p){ std::free(p); });
+    }
+
+    const char* data() const { return m_View.data(); }
+    std::size_t size() const { return m_View.size(); }
+    std::string_view view() const { return m_View; }
+
+private:
+    // smallest per node run worth spreading a buffer for, a few schedule chunks
+    static constexpr std::size_t NUMA_SPREAD_RUN = 1 << 20;
+
+    std::shared_ptr<const void> m_Owner;
+    std::string_view m_View;
 };
 
 std::string str_toupper(std::string s) {
@@ -66,85 +191,65 @@ std::size_t NearestPowerOfTwo(std::size_t v){
     return v;
 }
 
-// Lock-free is not wait free. with this container no need memory fence.
-// will yield better performance in GPU/Metal
+// Data cache size in bytes for level 1, 2 or 3 as the OS reports it. Some kernels/VMs report 0,
+// fall back to what a typical x86 core has then.
+std::size_t CacheSize(const int level){
+
+    long s = -1;
+    switch (level){
+    case 1: s = sysconf(_SC_LEVEL1_DCACHE_SIZE); break;
+    case 2: s = sysconf(_SC_LEVEL2_CACHE_SIZE); break;
+    case 3: s = sysconf(_SC_LEVEL3_CACHE_SIZE); break;
+    default: break;
+    }
+    if (s > 0){
+        return static_cast<std::size_t>(s);
+    }
+    return (level == 1) ? (32 << 10) : (level == 2) ? (1 << 20) : (8 << 20);
+}
+
+template<typename T, std::size_t N>
+class SlabPool;
+
 // this is static vector == array so no one past iterator for end. write after defined size will be buffer overflow
-template<typename T, std::size_t N = MAX_HIST_BIN_SIZE>
-class AlignedContinuousMemory
+// Objects are cache line aligned and heap blocks are padded to whole lines: two buffers, say two
+// threads' bins, never share a line.
+template<typename T, std::size_t N = INLINE_HIST_BIN_SIZE>
+class alignas(64) AlignedContinuousMemory
 {
     static constexpr std::size_t  CACHELINE_SIZE{64};
-    typename std::aligned_storage<sizeof(T), alignof(T)>::type data[N];
+    alignas(CACHELINE_SIZE) typename std::aligned_storage<sizeof(T), alignof(T)>::type data[N];
 
 public:
-    AlignedContinuousMemory(std::size_t size = 0)
+    // size <= N uses the inline storage, anything bigger is a cache line aligned heap block.
+    // Comes zeroed either way.
+    AlignedContinuousMemory(std::size_t size = N)
         : m_Data(nullptr),
           m_Size(0),
           m_CurrPos(0)
     {
-        if constexpr (N <= MAX_HIST_BIN_SIZE){
+        if (size <= N){
             m_Data = reinterpret_cast<T*>(&data);
-            m_Size = N;
+            m_Size = size;
+            clear();
         }else{
-            if (size > 0){
-                try{
-                    const auto s = NearestPowerOfTwo(size);
-                    m_Data = static_cast<T*>(std::aligned_alloc(std::max(CACHELINE_SIZE, s), sizeof(T) * size));
-                    clear();
-                }catch(std::exception& ex){
-                    std::cerr << " histo bins memory allocation failed" << std::endl;
-                    throw;
-                }
-                m_Size = size;
+            // calloc rather than aligned_alloc + memset: a big block is fresh pages the kernel zeroes
+            // when they are first touched, bins a histogram never hits cost nothing
+            const std::size_t bytes = (sizeof(T) * size + CACHELINE_SIZE - 1) & ~(CACHELINE_SIZE - 1);
+            m_Block = std::calloc(bytes + CACHELINE_SIZE, 1);
+            if (!m_Block){
+                std::cerr << " histo bins memory allocation failed" << std::endl;
+                throw std::bad_alloc();
             }
+            const std::uintptr_t at = (reinterpret_cast<std::uintptr_t>(m_Block) + CACHELINE_SIZE - 1) & ~(CACHELINE_SIZE - 1);
+            m_Data = reinterpret_cast<T*>(at);
+            m_Size = size;
         }
     }
 
-    AlignedContinuousMemory(const AlignedContinuousMemory& other){
-
-        AlignedContinuousMemory(other.m_Size);
-        std::uninitialized_copy(other.m_Data, other.m_Size, this->m_Data);
-    }
-
-    AlignedContinuousMemory(AlignedContinuousMemory&& other) noexcept{
-
-        this->m_Data = std::exchange(other.m_Data, nullptr);
-        this->m_Size = std::exchange(other.m_Size, 0);
-    }
-
-    AlignedContinuousMemory& operator=(AlignedContinuousMemory& other){
-
-        if (this != &other){
-            // If exception occurs in mem alloc exit here keeping the "other" untouched.
-            AlignedContinuousMemory m(other.m_Size);
-
-            if (this->m_Data){
-                std::free(m_Data);
-                m_Size = 0;
-            }
-            this->m_Data = m.m_Data;
-            this->m_Size = m.m_Size;
-            std::uninitialized_copy_n(other.m_Data, other.m_Size, this->m_Data);
-            m.m_Data = nullptr;
-            m.m_Size = 0;
-        }
-
-        return *this;
-    }
-
-    AlignedContinuousMemory& operator=(AlignedContinuousMemory&& other) noexcept{
-
-        if (this != &other){
-
-            if (this->m_Data){
-                std::free(m_Data);
-                m_Size = 0;
-            }
-            std::swap(other.m_Data, this->m_Data);
-            std::swap(other.m_Size, this->m_Size);
-        }
-
-        return *this;
-    }
+    // owned through pointers by SlabPool, never copied or moved
+    AlignedContinuousMemory(const AlignedContinuousMemory&) = delete;
+    AlignedContinuousMemory& operator=(const AlignedContinuousMemory&) = delete;
 
     template<typename ...Args>
     void emplace_back(Args&&... args) {
@@ -157,7 +262,7 @@ public:
 
     T& operator[](std::size_t pos) {
 
-        if (pos <= m_Size){
+        if (pos < m_Size){
             return *reinterpret_cast<T*>(&m_Data[pos]);
         }else{
             assert(false && "out of bound access");
@@ -169,15 +274,12 @@ public:
         for(std::size_t pos = 0; pos < m_Size; ++pos) {
             reinterpret_cast<T*>(&m_Data[pos])->~T();
         }
-        if (m_Data && !isInStack()){
-            std::free(m_Data);
-            m_Data = nullptr;
-        }
+        std::free(m_Block);
     }
 
     inline bool isInStack(){
 
-        return (m_Size <= MAX_HIST_BIN_SIZE);
+        return (m_Data == reinterpret_cast<T*>(&data));
     }
 
     std::size_t size() const {
@@ -196,80 +298,134 @@ public:
     T* end() { return m_Data + m_Size; }
 
 private:
+    friend class SlabPool<T, N>;
+
     T* m_Data;
     std::size_t m_Size;
     std::size_t m_CurrPos;
+    void* m_Block = nullptr;
+    // link while parked on SlabPool's shared stack
+    AlignedContinuousMemory* m_Next = nullptr;
 };
 
+/*
+ * Where ScopedStaticVector gets its buffers from. Every thread parks what it releases on a short
+ * free list of its own: taking and giving back is a scan of at most LOCAL_SLABS pointers, no lock,
+ * no hashing. Past that a release spills to one lock free stack shared by all threads, and a thread
+ * with nothing of the right size on its list drains that stack before allocating (the tallies a
+ * worker filled are mostly dropped by whichever thread merged them).
+ *
+ * Zeroing is lazy: a fresh buffer comes zeroed, a recycled one is cleared when it is taken again,
+ * not when it is given back.
+*/
 template<typename T, std::size_t N>
-class BinMemPool : public std::enable_shared_from_this<BinMemPool<T, N>>{
-
+class SlabPool
+{
 public:
-    std::shared_ptr<BinMemPool<T, N>> getBinMemPool() {
-        return this->shared_from_this();
+    using Slab = AlignedContinuousMemory<T, N>;
+
+    static constexpr std::size_t LOCAL_SLABS = 8;
+
+    static Slab* Acquire(const std::size_t size){
+
+        Slab* s = Cache().Take(size);
+        if (!s){
+            // the whole stack at once, popping one by one would need ABA tags
+            for (Slab* p = Shared().exchange(nullptr, std::memory_order_acquire); p; ){
+                Slab* next = std::exchange(p->m_Next, nullptr);
+                if (!s && p->size() == size){
+                    s = p;
+                }else{
+                    Release(p);
+                }
+                p = next;
+            }
+        }
+        if (!s){
+            return new Slab(size);
+        }
+        s->clear();
+        return s;
     }
 
-    ~BinMemPool(){
+    static void Release(Slab* s){
 
-        assert(m_AcquiredBuffers.empty());
-        for (auto& i : m_AvailableBuffers){
-            delete i;
+        Local& local = Cache();
+        if (local.free.size() < LOCAL_SLABS){
+            local.free.push_back(s);
+            return;
         }
+        std::atomic<Slab*>& shared = Shared();
+        s->m_Next = shared.load(std::memory_order_relaxed);
+        while (!shared.compare_exchange_weak(s->m_Next, s, std::memory_order_release, std::memory_order_relaxed)){}
     }
 
-    AlignedContinuousMemory<T, N>* GetBuffer(){
+private:
+    struct Local {
+        std::vector<Slab*> free;
 
-        std::lock_guard<std::mutex> lk(m_Gurad);
+        Slab* Take(const std::size_t size){
 
-        if (m_AvailableBuffers.empty()){
-            AlignedContinuousMemory<T, N>* m = new AlignedContinuousMemory<T, N>(N);
-            m_AcquiredBuffers.insert(m);
-            return m;
-        }else{
-            auto itr = m_AvailableBuffers.begin();
-            auto d = *itr;
-            m_AcquiredBuffers.insert(d);
-            m_AvailableBuffers.erase(itr);
-            d->clear();
-            return d;
+            for (std::size_t i = free.size(); i-- > 0; ){
+                if (free[i]->size() == size){
+                    Slab* s = free[i];
+                    free[i] = free.back();
+                    free.pop_back();
+                    return s;
+                }
+            }
+            return nullptr;
         }
-    }
 
-    void ReleaseBuffer(AlignedContinuousMemory<T, N>* freeBuf){
+        ~Local(){
+            for (Slab* s : free){
+                delete s;
+            }
+        }
+    };
+
+    struct Stack {
+        std::atomic<Slab*> head{nullptr};
+
+        ~Stack(){
+            for (Slab* s = head.load(); s; ){
+                delete std::exchange(s, s->m_Next);
+            }
+        }
+    };
 
-        std::lock_guard<std::mutex> lk(m_Gurad);
+    static Local& Cache(){
 
-        auto itr = m_AcquiredBuffers.find(freeBuf);
-        assert(itr != m_AcquiredBuffers.end());
-        m_AvailableBuffers.insert(*itr);
-        m_AcquiredBuffers.erase(itr);
+        thread_local Local local;
+        return local;
     }
 
-private:
-    std::mutex m_Gurad;
-    std::unordered_set<AlignedContinuousMemory<T, N>*> m_AvailableBuffers;
-    std::unordered_set<AlignedContinuousMemory<T, N>*> m_AcquiredBuffers;
+    static std::atomic<Slab*>& Shared(){
+
+        static Stack stack;
+        return stack.head;
+    }
 };
 
 // Class for memory recycling. RAII pattern
-template<typename T, std::size_t N = MAX_HIST_BIN_SIZE>
+template<typename T, std::size_t N = INLINE_HIST_BIN_SIZE>
 struct ScopedStaticVector{
 
     using value_type = RkUtil::AlignedContinuousMemory<T, N>;
     using iterator = T*;
 
 public:
-    ScopedStaticVector(std::size_t size = 0)
+    ScopedStaticVector(std::size_t size = N)
         : m_Data(nullptr),
           m_Size(size){
 
-        m_Data = m_MemPool->getBinMemPool()->GetBuffer();
+        m_Data = SlabPool<T, N>::Acquire(size);
     }
 
     ~ScopedStaticVector(){
 
         if (m_Data && m_CanRelease){
-            m_MemPool->getBinMemPool()->ReleaseBuffer(m_Data);
+            SlabPool<T, N>::Release(m_Data);
         }
     }
 
@@ -285,7 +441,7 @@ public:
 
         if (this != &rhs){
             if (m_Data){
-                m_MemPool->getBinMemPool()->ReleaseBuffer(m_Data);
+                SlabPool<T, N>::Release(m_Data);
                 m_Data = nullptr;
             }
             this->m_Data = std::exchange(rhs.m_Data, nullptr);
@@ -310,25 +466,131 @@ private:
     bool m_CanRelease = true;
     value_type* m_Data;
     std::size_t m_Size;
-    // bin will have multiple singleton instances of mempool of different sizes. MAX_HIST_BIN_SIZE is TODO:
-    static std::shared_ptr<BinMemPool<T, N>> m_MemPool;
 };
 
-template <typename T, std::size_t N>
-std::shared_ptr<BinMemPool<T, N>> ScopedStaticVector<T, N>::m_MemPool = std::make_shared<BinMemPool<T, N>>();
+// Blocking FIFO with a fixed capacity between a producer (decoder) and consumers (histogram workers).
+// Producer blocks while full so decoded data in flight stays bounded; Close() wakes everyone up and
+// lets consumers drain what is left.
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(std::size_t capacity)
+        : m_Capacity(std::max<std::size_t>(capacity, 1)) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+
+    // false if the queue was closed, item is dropped then.
+    bool Push(T&& item){
+
+        std::unique_lock<std::mutex> lk(m_Guard);
+        m_NotFull.wait(lk, [this]{ return m_Closed || m_Items.size() < m_Capacity; });
+        if (m_Closed){
+            return false;
+        }
+        m_Items.push_back(std::move(item));
+        lk.unlock();
+        m_NotEmpty.notify_one();
+        return true;
+    }
+
+    // false once the queue is closed and drained.
+    bool Pop(T& item){
+
+        std::unique_lock<std::mutex> lk(m_Guard);
+        m_NotEmpty.wait(lk, [this]{ return m_Closed || !m_Items.empty(); });
+        if (m_Items.empty()){
+            return false;
+        }
+        item = std::move(m_Items.front());
+        m_Items.pop_front();
+        lk.unlock();
+        m_NotFull.notify_one();
+        return true;
+    }
+
+    void Close(){
+
+        {
+            std::lock_guard<std::mutex> lk(m_Guard);
+            m_Closed = true;
+        }
+        m_NotEmpty.notify_all();
+        m_NotFull.notify_all();
+    }
+
+private:
+    const std::size_t m_Capacity;
+    bool m_Closed = false;
+    std::mutex m_Guard;
+    std::condition_variable m_NotEmpty;
+    std::condition_variable m_NotFull;
+    std::deque<T> m_Items;
+};
+
+// Fixed set of equally sized decode buffers, carved out of one allocation and handed out over and
+// over: Acquire() blocks while all of them are out, a buffer comes back once the last slice holding
+// it is gone. Decoded data in flight stays within Count() * Size() bytes however big the payload.
+// The most recently returned buffer goes out first, it is the likeliest to still be in cache.
+// Must outlive every buffer it handed out.
+class BufferRing
+{
+public:
+    BufferRing(std::size_t count, std::size_t size)
+        : m_Size(std::max<std::size_t>(size, 1)),
+          m_Count(std::max<std::size_t>(count, 1)),
+          m_Block(PayloadSlice::AllocateBuffer(m_Count * m_Size)){
+
+        for (std::size_t i = m_Count; i-- > 0; ){
+            m_Free.push_back(m_Block.get() + i * m_Size);
+        }
+    }
+
+    BufferRing(const BufferRing&) = delete;
+
+    std::size_t Size() const { return m_Size; }
+    std::size_t Count() const { return m_Count; }
+
+    std::shared_ptr<char[]> Acquire(){
+
+        std::unique_lock<std::mutex> lk(m_Guard);
+        m_Returned.wait(lk, [this]{ return !m_Free.empty(); });
+        char* buffer = m_Free.back();
+        m_Free.pop_back();
+        return std::shared_ptr<char[]>(buffer, [this](char* b){ Release(b); });
+    }
+
+private:
+    void Release(char* buffer){
+
+        {
+            std::lock_guard<std::mutex> lk(m_Guard);
+            m_Free.push_back(buffer);
+        }
+        m_Returned.notify_one();
+    }
+
+    const std::size_t m_Size;
+    const std::size_t m_Count;
+    std::shared_ptr<char[]> m_Block;
+    std::mutex m_Guard;
+    std::condition_variable m_Returned;
+    std::vector<char*> m_Free;
+};
 
+// 64 bit all the way: light sheet stacks are tens of G voxels
 template <typename RandomIt>
-int parallel_multiply(RandomIt beg, RandomIt end)
+std::uint64_t parallel_multiply(RandomIt beg, RandomIt end)
 {
     auto len = end - beg;
     if (len < 8)
-        return std::accumulate(beg, end, 1, std::multiplies<std::size_t>());
+        return std::accumulate(beg, end, std::uint64_t(1), std::multiplies<std::uint64_t>());
 
     RandomIt mid = beg + len/2;
     auto handle = std::async(std::launch::async,
                              parallel_multiply<RandomIt>, mid, end);
-    int product = parallel_multiply(beg, mid);
-    return product + handle.get();
+    std::uint64_t product = parallel_multiply(beg, mid);
+    return product * handle.get();
 }
 
 // ref: http://teem.sourceforge.net/nrrd/format.html#encoding
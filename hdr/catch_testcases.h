@@ -4,21 +4,30 @@
 #define CATCH_CONFIG_MAIN
 #include "../hdr/catch.hpp"
 
-std::unique_ptr<Task> Test_Function(std::string filename)
+std::unique_ptr<Task> Test_Function(std::string filename, std::vector<std::string> args = {})
 {
     std::unique_ptr<RkConfig> config = std::make_unique<RkConfig>([](config_data &d, boost::program_options::options_description &desc){
         desc.add_options()
-                ("bins, b", boost::program_options::value<std::uint16_t>(&d.bins)->default_value(300), "# of bins in histogram (int)")
-                ("min, min", boost::program_options::value<double>(&d.min)->default_value(0.0), "Value at low end of histogram. Defaults to lowest value found in input nrrd. (double)")
-                ("max, max", boost::program_options::value<double>(&d.max)->default_value(300.0), "Value at high end of histogram. Defaults to highest value found in input nrrd. (double)")
-                ("type, t", boost::program_options::value<uint8_t>(&d.type)->default_value(1), "type to use for bins in output histogram; default: \"uint\"")
+                ("bins, b", boost::program_options::value<std::uint32_t>(&d.bins)->default_value(300), "# of bins in histogram (int)")
+                ("min, min", boost::program_options::value<double>(&d.min)->default_value(std::numeric_limits<double>::quiet_NaN(), "auto"), "Value at low end of histogram. Defaults to lowest value found in input nrrd. (double)")
+                ("max, max", boost::program_options::value<double>(&d.max)->default_value(std::numeric_limits<double>::quiet_NaN(), "auto"), "Value at high end of histogram. Defaults to highest value found in input nrrd. (double)")
+                ("type,t", boost::program_options::value<std::string>(&d.type)->default_value("uint"), "type to use for bins in output histogram: uchar | uint | ulonglong (or uint8 | uint32 | uint64), counts saturate at its max; default: \"uint\"")
                 ("input, i", boost::program_options::value<std::string>(&d.input_file_name)->default_value("../res/sample.nrrd"), "input nrrd")
-                ("output, o", boost::program_options::value<std::string>(&d.output_file_name)->default_value("../solution.txt"), "solution file");
+                ("output, o", boost::program_options::value<std::string>(&d.output_file_name)->default_value("../solution.txt"), "solution file")
+                ("pipeline", boost::program_options::bool_switch(&d.pipeline)->default_value(false), "overlap decoding and histogramming through a bounded queue of decoded chunks")
+                ("stream", boost::program_options::value<std::size_t>(&d.stream)->default_value(0), "bounded memory streaming (implies --pipeline): decode through a ring of buffers of at most this many MiB, peak memory independent of the volume size; 0: off")
+                ("gzip", boost::program_options::value<std::string>(&d.gzip)->default_value(RkEncoders::DEFAULT_GZIP_BACKEND), "gzip inflate backend: boost | gzio | indexed (parallel, keeps <input>.gzidx next to the input) | speculative (parallel, no index)")
+                ("kernel", boost::program_options::value<std::string>(&d.kernel)->default_value("auto"), "hot loop variant: auto (best the CPU has) | scalar | avx2 | avx512")
+                ("pin", boost::program_options::value<std::string>(&d.pin)->default_value("none"), "worker pinning: none | compact (hyperthread siblings together) | scatter (every core before any sibling) | physical (one worker per physical core)")
+                ("backend", boost::program_options::value<std::string>(&d.backend)->default_value("pool"), "where the parallel loops run: pool (own workers) | tbb (the TBB arena of the caller) | openmp (an OpenMP team, builds with -DWITH_OPENMP=ON)");
     });
 
     try {
-        char* a[] = {"Ex2", "--i", filename.data()};
-        config->parse(3, a);
+        std::vector<char*> a = {"Ex2", "--i", filename.data()};
+        for (std::string& arg : args){
+            a.push_back(arg.data());
+        }
+        config->parse(a.size(), a.data());
     }
     catch(std::exception const& e) {
         std::cout << e.what();
@@ -30,6 +39,67 @@ std::unique_ptr<Task> Test_Function(std::string filename)
     return task;
 }
 
+// One gzip member of data, level 0 keeps the bytes verbatim in the compressed stream
+std::string GzipMember(const std::string& data, int level = 6){
+
+    z_stream strm{};
+    deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&strm, data.size()), '\0');
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<Bytef*>(out.data());
+    strm.avail_out = out.size();
+    deflate(&strm, Z_FINISH);
+    out.resize(strm.total_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+// 1D test volume written next to the test binary: raw, or gzip in as many members as asked for
+std::string WriteNrrd(const std::string& name, const char* type, const std::string& payload,
+                      std::size_t members = 0, int level = 6){
+
+    std::ofstream out(name, std::ios::binary | std::ios::trunc);
+    out << "NRRD0004\ntype: " << type << "\ndimension: 1\nsizes: " << payload.size() / RkUtil::PAYLOAD_TYPE_SIZE[(int)RkUtil::PayLoadType.at(RkUtil::str_toupper(type))]
+        << "\nendian: little\nencoding: " << (members ? "gzip" : "raw") << "\n\n";
+    if (!members){
+        out << payload;
+    }
+    const std::size_t step = members ? (payload.size() / members + 1) : 0;
+    for (std::size_t m = 0; m < members; ++m){
+        out << GzipMember(payload.substr(std::min(m * step, payload.size()), step), level);
+    }
+    return name;
+}
+
+// n values of T spread over [lo, hi], both ends included
+template<typename T>
+std::string Values(std::size_t n, double lo, double hi){
+
+    std::string payload(n * sizeof(T), '\0');
+    std::uint64_t x = 88172645463325252ull;
+    for (std::size_t i = 0; i < n; ++i){
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        T v = static_cast<T>(i == 0 ? lo : i == 1 ? hi : lo + double(x % 1000003) / 1000003 * (hi - lo));
+        std::memcpy(&payload[i * sizeof(T)], &v, sizeof(T));
+    }
+    return payload;
+}
+
+std::string ReadFile(const std::string& name){
+
+    std::ifstream in(name, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// histogram file of input under args, written to name
+std::string HistogramOf(const std::string& input, std::vector<std::string> args, const std::string& name = "mode.txt"){
+
+    args.insert(args.end(), {"--o", name});
+    Test_Function(input, args);
+    return ReadFile(name);
+}
+
 TEST_CASE("Validate Output with Total Pixels")
 {
     // check /res/short-gzip.nrrd
@@ -51,3 +121,628 @@ TEST_CASE("Validate Output with Total Pixels")
     auto o3 = (3*128*128);
     REQUIRE(t3->OutputVal() == o3);
 }
+
+TEST_CASE("Linear binning of min max bins")
+{
+    // 4 bins over [0, 100]: 25 values wide, 100 itself in the last bin, outliers clamped
+    const std::int16_t values[] = {0, 24, 25, 99, 100, 150, -5};
+    const std::string_view data(reinterpret_cast<const char*>(values), sizeof(values));
+
+    std::array<std::uint32_t, 4> hist{};
+    auto kernel = RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeShort, 0, 100, 4);
+    kernel(data, hist.data());
+    REQUIRE(hist == std::array<std::uint32_t, 4>{3, 1, 0, 3});
+
+    // fractional range takes the floating point path: [-0.5, 99.5] bins the same values alike
+    hist.fill(0);
+    kernel = RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeShort, -0.5, 99.5, 4);
+    kernel(data, hist.data());
+    REQUIRE(hist == std::array<std::uint32_t, 4>{3, 1, 0, 3});
+}
+
+TEST_CASE("Bin counts past the inline buffer")
+{
+    // 65536 bins over the whole ushort range: one bin per value
+    std::vector<std::uint16_t> values(1 << 16);
+    std::iota(values.begin(), values.end(), 0);
+    const std::string_view data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(std::uint16_t));
+
+    RkUtil::ScopedStaticVector<std::uint32_t> hist(values.size());
+    REQUIRE(std::size_t(hist.end() - hist.begin()) == values.size());
+    auto kernel = RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeUShort, 0, 65536, 65536);
+    kernel(data, hist.begin());
+    REQUIRE(std::all_of(hist.begin(), hist.end(), [](std::uint32_t c){ return c == 1; }));
+
+    // millions of bins: past L2, batched loop
+    const std::int32_t ints[] = {0, 1, 3999999, 4000000, -7};
+    const std::string_view idata(reinterpret_cast<const char*>(ints), sizeof(ints));
+    RkUtil::ScopedStaticVector<std::uint32_t> big(4000000);
+    kernel = RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeInt, 0, 4000000, 4000000);
+    kernel(idata, big.begin());
+    REQUIRE(big[0] == 2);
+    REQUIRE(big[1] == 1);
+    REQUIRE(big[3999999] == 2);
+    REQUIRE(std::accumulate(big.begin(), big.end(), std::size_t(0)) == 5);
+}
+
+TEST_CASE("Sub histograms fold to the same counts")
+{
+    // mostly one value, odd length so the tail past the last full round of copies is exercised
+    std::vector<std::uint8_t> values(10007, 0);
+    for (std::size_t i = 0; i < values.size(); i += 7){
+        values[i] = static_cast<std::uint8_t>(i);
+    }
+    const std::string_view data(reinterpret_cast<const char*>(values.data()), values.size());
+
+    std::array<std::uint32_t, 16> expected{};
+    for (const auto v : values){
+        expected[v / 16] += 1;
+    }
+    std::array<std::uint32_t, 16> hist{};
+    auto kernel = RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeUChar, 0, 256, 16);
+    kernel(data, hist.data());
+    REQUIRE(hist == expected);
+}
+
+TEST_CASE("Narrow local counters carry exactly")
+{
+    std::vector<std::int32_t> values(400009);
+    for (std::size_t i = 0; i < values.size(); ++i){
+        // half in one bin: wraps 8 bit counters hundreds of times and 16 bit ones a few
+        values[i] = (i % 2) ? 7 : static_cast<std::int32_t>((i * 2654435761u) % 100000);
+    }
+    const std::string_view data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(std::int32_t));
+
+    RkKernels::ScaledBinning<std::int32_t, RkKernels::ClampPolicy::Clamp> binning;
+    RkKernels::ScaledBinning<std::int32_t, RkKernels::ClampPolicy::Clamp>::Make(0, 100000, 50000, binning);
+
+    std::vector<std::uint32_t> expected(50000), hist(50000);
+    RkKernels::AccumulateStraight<std::int32_t, std::uint32_t>(data, expected.data(), binning);
+    RkKernels::AccumulateNarrow<std::int32_t, std::uint8_t, std::uint32_t>(data, hist.data(), binning, 50000);
+    REQUIRE(hist == expected);
+    std::fill(hist.begin(), hist.end(), 0);
+    RkKernels::AccumulateNarrow<std::int32_t, std::uint16_t, std::uint32_t>(data, hist.data(), binning, 50000);
+    REQUIRE(hist == expected);
+    std::vector<std::uint64_t> wide(50000);
+    RkKernels::AccumulateNarrow<std::int32_t, std::uint8_t, std::uint64_t>(data, wide.data(), binning, 50000);
+    REQUIRE(std::equal(wide.begin(), wide.end(), expected.begin()));
+
+    // slices shorter than the histogram take the batched loop
+    std::fill(hist.begin(), hist.end(), 0);
+    RkKernels::AccumulateNarrow<std::int32_t, std::uint8_t, std::uint32_t>(data.substr(0, 400), hist.data(), binning, 50000);
+    REQUIRE(std::accumulate(hist.begin(), hist.end(), std::uint64_t(0)) == 100);
+}
+
+TEST_CASE("Vector kernels count like the scalar loop")
+{
+    std::vector<std::int16_t> values(100003);
+    for (std::size_t i = 0; i < values.size(); ++i){
+        // mostly one value, the rest spread over the domain
+        values[i] = (i % 5) ? std::int16_t(-1000) : static_cast<std::int16_t>(i * 2654435761u);
+    }
+    const std::string_view data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(std::int16_t));
+
+    RkKernels::ScaledBinning<std::int16_t, RkKernels::ClampPolicy::Clamp> binning;
+    RkKernels::ScaledBinning<std::int16_t, RkKernels::ClampPolicy::Clamp>::Make(-20000, 20000, 5000, binning);
+    const auto lookup = RkKernels::LookupBinning<std::int16_t, std::uint16_t>::Make(binning);
+
+    std::vector<std::uint32_t> expected(5000), hist(5000);
+    RkKernels::AccumulateStraight<std::int16_t, std::uint32_t>(data, expected.data(), lookup);
+    const auto isa = RkKernels::DetectIsa();
+    if (isa == RkKernels::Isa::Avx512){
+        RkKernels::AccumulateAvx512<std::int16_t, std::uint32_t>(data, hist.data(), lookup.table);
+        REQUIRE(hist == expected);
+        std::vector<std::uint64_t> wide(5000);
+        RkKernels::AccumulateAvx512<std::int16_t, std::uint64_t>(data, wide.data(), lookup.table);
+        REQUIRE(std::equal(wide.begin(), wide.end(), expected.begin()));
+    }
+    if (isa != RkKernels::Isa::Scalar){
+        std::fill(hist.begin(), hist.end(), 0);
+        RkKernels::AccumulateAvx2<std::int16_t, std::uint32_t>(data, hist.data(), lookup.table);
+        REQUIRE(hist == expected);
+    }
+}
+
+TEST_CASE("Kernel variants and byte swapped input bin alike")
+{
+    std::vector<std::int32_t> values(50000);
+    for (std::size_t i = 0; i < values.size(); ++i){
+        values[i] = static_cast<std::int32_t>((i * 2654435761u) % 200000) - 50000;
+    }
+    const std::string_view data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(std::int32_t));
+    std::vector<std::int32_t> swapped(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i){
+        swapped[i] = static_cast<std::int32_t>(__builtin_bswap32(static_cast<std::uint32_t>(values[i])));
+    }
+    const std::string_view swapped_data(reinterpret_cast<const char*>(swapped.data()), swapped.size() * sizeof(std::int32_t));
+
+    const auto best = RkKernels::DetectIsa();
+    std::vector<std::uint32_t> expected(777);
+    RkKernels::SelectIsa(RkKernels::Isa::Scalar);
+    RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeInt, -1000, 100000, 777)(data, expected.data());
+
+    for (const auto isa : {RkKernels::Isa::Scalar, RkKernels::Isa::Avx2, RkKernels::Isa::Avx512}){
+        if (isa > best){
+            continue;
+        }
+        RkKernels::SelectIsa(isa);
+        auto kernel = RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeInt, -1000, 100000, 777);
+        std::vector<std::uint32_t> hist(777), hist_swapped(777);
+        kernel(data, hist.data());
+        RkKernels::SwapKernel(kernel, sizeof(std::int32_t))(swapped_data, hist_swapped.data());
+        REQUIRE(hist == expected);
+        REQUIRE(hist_swapped == expected);
+    }
+    RkKernels::SelectIsa(best);
+}
+
+TEST_CASE("Radix partitioned counting matches direct counting")
+{
+    RkKernels::RadixPlan plan;
+    REQUIRE_FALSE(RkKernels::PlanRadix(300, sizeof(std::uint32_t), 1, plan));
+    const std::size_t bins = 20000000;
+    REQUIRE(RkKernels::PlanRadix(bins, sizeof(std::uint32_t), 1, plan));
+
+    std::vector<std::uint32_t> values(300007);
+    for (std::size_t i = 0; i < values.size(); ++i){
+        // a third of the values in one bin so that bucket outgrows its reserve
+        values[i] = (i % 3) ? static_cast<std::uint32_t>((i * 2654435761u) % 40000000) : 123456;
+    }
+    const std::string_view data(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(std::uint32_t));
+
+    std::vector<std::uint32_t> expected(bins), hist(bins);
+    RkKernels::MakeKernel<std::uint32_t>(RkUtil::PAYLOAD_TYPE::TypeUInt, 0, 40000000, bins)(data, expected.data());
+
+    std::vector<RkKernels::BinIndex> indices(values.size());
+    RkKernels::MakeKernel<RkKernels::BinIndex>(RkUtil::PAYLOAD_TYPE::TypeUInt, 0, 40000000, bins)(data, indices.data());
+    RkKernels::RadixPartition partition(plan);
+    for (int round = 0; round < 2; ++round){
+        partition.Clear();
+        partition.Reserve(values.size());
+        partition.Add(indices.data(), indices.size());
+        partition.Flush();
+        for (std::size_t b = 0; b < plan.buckets; ++b){
+            RkKernels::CountBucket(partition.Bucket(b), hist.data());
+        }
+    }
+    for (auto& c : expected){
+        c *= 2;
+    }
+    REQUIRE(hist == expected);
+}
+
+TEST_CASE("Voxel counts past 32 bit")
+{
+    // light sheet stack: 2048 x 2048 x 5000 x 3 channels, twice the serial cut off of 8 sizes
+    std::array<std::size_t, 16> sizes;
+    sizes.fill(1);
+    sizes[0] = 2048;
+    sizes[1] = 2048;
+    sizes[2] = 5000;
+    sizes[12] = 3;
+    REQUIRE(RkUtil::parallel_multiply(sizes.begin(), sizes.end()) == std::uint64_t(2048) * 2048 * 5000 * 3);
+    REQUIRE(RkUtil::parallel_multiply(sizes.begin(), sizes.begin() + 3) == std::uint64_t(2048) * 2048 * 5000);
+}
+
+TEST_CASE("Thread pool runs every task once")
+{
+    // one worker: a fan out from inside a task must not wait on helpers that cannot start
+    RkUtil::ThreadPool pool(1);
+    std::vector<std::future<std::size_t>> futures;
+    for (std::size_t t = 0; t < 64; ++t){
+        futures.push_back(pool.Submit([&pool, t]{
+            std::vector<std::size_t> hits(100, 0);
+            pool.ParallelFor(4, hits.size(), [&hits](std::size_t i){ hits[i] += 1; });
+            return t + std::accumulate(hits.begin(), hits.end(), std::size_t(0));
+        }));
+    }
+    for (std::size_t t = 0; t < futures.size(); ++t){
+        REQUIRE(futures[t].get() == t + 100);
+    }
+
+    std::atomic<std::size_t> calls{0};
+    Task::Pool().ParallelFor(Task::NO_OF_CORES + 3, 1000, [&calls](std::size_t){ ++calls; });
+    REQUIRE(calls == 1000);
+}
+
+TEST_CASE("Stealing queues hand out every chunk once")
+{
+    RkUtil::StealingQueues<std::size_t> queues(4);
+    for (std::size_t i = 0; i < 10; ++i){
+        queues.Push(0, i);
+    }
+    std::size_t item = 0;
+    // the owner works from the front, a thief from the back
+    REQUIRE(queues.Pop(0, item));
+    REQUIRE(item == 0);
+    REQUIRE(queues.Pop(2, item));
+    REQUIRE(item == 9);
+
+    for (std::size_t i = 10; i < 100010; ++i){
+        queues.Push(i % 4, i);
+    }
+    std::vector<std::vector<std::size_t>> taken(4);
+    Task::Pool().ParallelFor(4, 4, [&queues, &taken](std::size_t w){
+        for (std::size_t i; queues.Pop(w, i); ){
+            taken[w].push_back(i);
+        }
+    });
+    std::vector<std::size_t> all;
+    for (const auto& t : taken){
+        all.insert(all.end(), t.begin(), t.end());
+    }
+    std::sort(all.begin(), all.end());
+    // 1 .. 8 left of the first lot
+    REQUIRE(all.size() == 100008);
+    REQUIRE(std::adjacent_find(all.begin(), all.end()) == all.end());
+    REQUIRE(all.front() == 1);
+    REQUIRE(all.back() == 100009);
+}
+
+TEST_CASE("Summing partial histograms")
+{
+    const std::size_t bins = 1001;
+    std::vector<std::vector<std::uint64_t>> parts(11, std::vector<std::uint64_t>(bins));
+    for (std::size_t p = 0; p < parts.size(); ++p){
+        std::iota(parts[p].begin(), parts[p].end(), p);
+    }
+    std::vector<const std::uint64_t*> srcs;
+    for (std::size_t p = 1; p < parts.size(); ++p){
+        srcs.push_back(parts[p].data());
+    }
+    // 10 sources: two passes of four and two single ones
+    RkKernels::SumCounts(parts[0].data(), srcs.data(), srcs.size(), bins);
+    std::vector<std::uint64_t> expected(bins);
+    for (std::size_t b = 0; b < bins; ++b){
+        expected[b] = 11 * b + 55;
+    }
+    REQUIRE(parts[0] == expected);
+}
+
+TEST_CASE("Slab pool recycles zeroed cache line aligned buffers")
+{
+    using Pool = RkUtil::SlabPool<std::uint32_t, RkUtil::INLINE_HIST_BIN_SIZE>;
+    for (const std::size_t size : {std::size_t(7), std::size_t(300), std::size_t(100003)}){
+        std::uint32_t* first;
+        {
+            RkUtil::ScopedStaticVector<std::uint32_t> v(size);
+            first = v.begin();
+            REQUIRE(reinterpret_cast<std::uintptr_t>(first) % 64 == 0);
+            REQUIRE(std::all_of(v.begin(), v.end(), [](std::uint32_t c){ return c == 0; }));
+            std::fill(v.begin(), v.end(), 0xdead);
+        }
+        // same thread, same size: the buffer just given back, cleared again
+        RkUtil::ScopedStaticVector<std::uint32_t> v(size);
+        REQUIRE(v.begin() == first);
+        REQUIRE(std::all_of(v.begin(), v.end(), [](std::uint32_t c){ return c == 0; }));
+    }
+
+    // overflowing the local list spills to the shared stack, another thread picks them up
+    std::vector<Pool::Slab*> slabs;
+    for (std::size_t i = 0; i < 2 * Pool::LOCAL_SLABS; ++i){
+        slabs.push_back(Pool::Acquire(4321));
+    }
+    for (Pool::Slab* s : slabs){
+        s->start()[0] = 1;
+        Pool::Release(s);
+    }
+    // checked after join(), Catch assertions are not thread safe
+    bool spilled = false, cleared = false;
+    std::thread([&slabs, &spilled, &cleared]{
+        Pool::Slab* s = Pool::Acquire(4321);
+        spilled = std::find(slabs.begin(), slabs.end(), s) != slabs.end();
+        cleared = s->start()[0] == 0;
+        Pool::Release(s);
+    }).join();
+    REQUIRE(spilled);
+    REQUIRE(cleared);
+}
+
+TEST_CASE("NUMA node lists and node grouped work")
+{
+    REQUIRE(RkUtil::Numa::ParseList("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+    REQUIRE(RkUtil::Numa::ParseList("").empty());
+    // 6 workers on 4 nodes: 2 1 2 1, the two helpers agree
+    for (std::size_t w = 0; w < 6; ++w){
+        const std::size_t node = RkUtil::Numa::NodeOfWorker(w, 6, 4);
+        REQUIRE(RkUtil::Numa::FirstWorker(node, 6, 4) <= w);
+        REQUIRE(w < RkUtil::Numa::FirstWorker(node + 1, 6, 4));
+    }
+    REQUIRE(RkUtil::Numa::FirstWorker(4, 6, 4) == 6);
+
+    // worker 1 of group {0, 1} steals from 0 before it reaches over to group {2, 3}
+    RkUtil::StealingQueues<std::size_t> queues(4, 2);
+    queues.Push(0, 7);
+    queues.Push(2, 8);
+    std::size_t item = 0;
+    REQUIRE(queues.Pop(1, item));
+    REQUIRE(item == 7);
+    REQUIRE(queues.Pop(1, item));
+    REQUIRE(item == 8);
+    REQUIRE(!queues.Pop(3, item));
+
+    const std::vector<std::size_t> counts{5, 0, 300};
+    std::vector<std::vector<std::atomic<int>>> hits;
+    for (std::size_t count : counts){
+        hits.emplace_back(count);
+    }
+    Task::Pool().ParallelForNodes(Task::NO_OF_CORES + 1, counts, [&hits](std::size_t node, std::size_t i){ ++hits[node][i]; });
+    for (const auto& node : hits){
+        REQUIRE(std::all_of(node.begin(), node.end(), [](const std::atomic<int>& h){ return h == 1; }));
+    }
+}
+
+TEST_CASE("Usable cpus from affinity and cgroup quota")
+{
+    REQUIRE(RkUtil::Affinity::CpuMax("max 100000") == 0);
+    REQUIRE(RkUtil::Affinity::CpuMax("150000 100000") == 1.5);
+    REQUIRE(RkUtil::Affinity::CfsQuota("-1", "100000") == 0);
+    REQUIRE(RkUtil::Affinity::CfsQuota("400000", "100000") == 4);
+    REQUIRE(RkUtil::Affinity::CpuMax("") == 0);
+
+    const std::size_t usable = RkUtil::Affinity::UsableCpus();
+    REQUIRE(usable >= 1);
+    REQUIRE(usable <= RkUtil::Affinity::AllowedCpus().size());
+
+    // every policy only hands out allowed cpus, physical one per core
+    const std::vector<int> allowed = RkUtil::Affinity::AllowedCpus();
+    for (RkUtil::Pinning pinning : {RkUtil::Pinning::Compact, RkUtil::Pinning::Scatter, RkUtil::Pinning::Physical}){
+        std::size_t cpus = 0;
+        for (const auto& node : RkUtil::Affinity::PinOrder(pinning, RkUtil::Numa::Topology())){
+            for (int cpu : node){
+                REQUIRE(std::find(allowed.begin(), allowed.end(), cpu) != allowed.end());
+            }
+            cpus += node.size();
+        }
+        REQUIRE(cpus >= 1);
+        REQUIRE(cpus <= allowed.size());
+        if (pinning != RkUtil::Pinning::Physical){
+            REQUIRE(cpus == allowed.size());
+        }
+    }
+    // the pool runs by now, only the policy it started with is accepted
+    Task::Pool();
+    REQUIRE_NOTHROW(Task::Pin(RkUtil::Pinning::None));
+    REQUIRE_THROWS(Task::Pin(RkUtil::Pinning::Compact));
+}
+
+TEST_CASE("Execution backends count alike")
+{
+    auto read = [](const char* name){
+        std::ifstream in(name);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+    for (const char* input : {"../res/sample.nrrd", "../res/uchar-raw.nrrd"}){
+        for (const char* bins : {"300", "3000000"}){
+            const auto tbb = Test_Function(input, {"--backend", "tbb", "--o", "backend-tbb.txt", "--bins", bins, "--min", "0", "--max", "255"});
+            const auto pool = Test_Function(input, {"--backend", "pool", "--o", "backend-pool.txt", "--bins", bins, "--min", "0", "--max", "255"});
+            REQUIRE(tbb->OutputVal() == pool->OutputVal());
+            REQUIRE(read("backend-tbb.txt") == read("backend-pool.txt"));
+#ifdef RK_WITH_OPENMP
+            const auto omp = Test_Function(input, {"--backend", "openmp", "--o", "backend-omp.txt", "--bins", bins, "--min", "0", "--max", "255"});
+            REQUIRE(omp->OutputVal() == pool->OutputVal());
+            REQUIRE(read("backend-omp.txt") == read("backend-pool.txt"));
+#endif
+        }
+    }
+#ifndef RK_WITH_OPENMP
+    REQUIRE_THROWS(Test_Function("../res/sample.nrrd", {"--backend", "openmp"}));
+#endif
+    Task::Use(RkUtil::ExecutionBackend::Pool);
+
+    // every chunk once, never two bodies on one slot at a time
+    RkUtil::TbbExecutor tbb;
+    std::vector<std::atomic<int>> hits(10000), busy(tbb.Concurrency());
+    std::atomic<bool> clash{false};
+    tbb.Fold(std::vector<std::size_t>(hits.size(), 0), [&](std::size_t chunk, std::size_t slot){
+        if (slot >= busy.size() || ++busy[slot] != 1){
+            clash = true;
+            return;
+        }
+        ++hits[chunk];
+        --busy[slot];
+    });
+    REQUIRE(!clash);
+    REQUIRE(std::all_of(hits.begin(), hits.end(), [](const std::atomic<int>& h){ return h == 1; }));
+
+    // capped loops: every index once, never more than the cap running at once
+    RkUtil::PoolExecutor pool(Task::Pool(), Task::NO_OF_CORES);
+    for (RkUtil::Executor* executor : {static_cast<RkUtil::Executor*>(&pool), static_cast<RkUtil::Executor*>(&tbb)}){
+        std::vector<std::atomic<int>> seen(1000);
+        std::atomic<int> running{0}, peak{0};
+        executor->ParallelForUpTo(2, seen.size(), [&](std::size_t i){
+            const int now = ++running;
+            for (int p = peak; now > p && !peak.compare_exchange_weak(p, now); ){}
+            ++seen[i];
+            --running;
+        });
+        REQUIRE(peak <= 2);
+        REQUIRE(std::all_of(seen.begin(), seen.end(), [](const std::atomic<int>& h){ return h == 1; }));
+    }
+}
+
+TEST_CASE("Bounded memory streaming counts like the in memory histogram")
+{
+    // the most recently returned buffer goes out again, Acquire() waits while all are out
+    RkUtil::BufferRing ring(2, 4096);
+    auto a = ring.Acquire();
+    auto b = ring.Acquire();
+    char* const first = a.get();
+    // Catch assertions stay on this thread, the waiter only records what it got
+    std::atomic<bool> got{false};
+    char* recycled = nullptr;
+    std::thread waiter([&ring, &got, &recycled]{
+        auto c = ring.Acquire();
+        recycled = c.get();
+        got = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(!got);
+    a.reset();
+    waiter.join();
+    REQUIRE(got);
+    REQUIRE(recycled == first);
+
+    auto read = [](const char* name){
+        std::ifstream in(name);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+    for (const char* input : {"../res/sample.nrrd", "../res/uchar-raw.nrrd"}){
+        for (const char* gzip : {"boost", "gzio", "indexed", "speculative"}){
+            // auto range (two passes for wide types), fixed range
+            for (const bool fixed : {false, true}){
+                std::vector<std::string> args = {"--gzip", gzip, "--bins", "1000"};
+                if (fixed){
+                    args.insert(args.end(), {"--min", "-10", "--max", "300"});
+                }
+                std::vector<std::string> streamed = args;
+                streamed.insert(streamed.end(), {"--stream", "1", "--o", "stream-bounded.txt"});
+                args.insert(args.end(), {"--o", "stream-memory.txt"});
+                const auto memory = Test_Function(input, args);
+                const auto bounded = Test_Function(input, streamed);
+                REQUIRE(memory->OutputVal() == bounded->OutputVal());
+                REQUIRE(read("stream-memory.txt") == read("stream-bounded.txt"));
+            }
+        }
+    }
+}
+
+TEST_CASE("Indexed gzip and its sidecar count like boost")
+{
+    // a few MB of output, so the index has several access points
+    const std::string input = WriteNrrd("indexed.nrrd", "short", Values<std::int16_t>(3 << 20, -30000, 30000), 1);
+    const std::string sidecar = input + ".gzidx";
+    std::remove(sidecar.c_str());
+    const std::vector<std::string> args = {"--bins", "5000", "--min", "-30000", "--max", "30000"};
+    auto with = [&args](const char* gzip){
+        std::vector<std::string> a = args;
+        a.insert(a.end(), {"--gzip", gzip});
+        return a;
+    };
+    const std::string expected = HistogramOf(input, with("boost"));
+
+    // first read inflates serially and saves the index, the next one inflates from it
+    REQUIRE(HistogramOf(input, with("indexed")) == expected);
+    const std::string saved = ReadFile(sidecar);
+    REQUIRE(saved.size() > 36);
+    REQUIRE(HistogramOf(input, with("indexed")) == expected);
+
+    // a stale or damaged sidecar is rebuilt rather than trusted: halved total_out, absurd count
+    for (const std::size_t at : {std::size_t(20), std::size_t(28)}){
+        std::string damaged = saved;
+        std::uint64_t v;
+        std::memcpy(&v, &damaged[at], sizeof(v));
+        v = (at == 20) ? v / 2 : (std::uint64_t(1) << 60);
+        std::memcpy(&damaged[at], &v, sizeof(v));
+        std::ofstream(sidecar, std::ios::binary | std::ios::trunc) << damaged;
+        REQUIRE(HistogramOf(input, with("indexed")) == expected);
+        REQUIRE(ReadFile(sidecar) == saved);
+    }
+}
+
+TEST_CASE("Multi member gzip inflates per member or falls back")
+{
+    const std::string payload = Values<std::uint8_t>(1 << 20, 0, 255);
+    const std::string input = WriteNrrd("members.nrrd", "uchar", payload, 4);
+    std::vector<GzMember> members;
+    const std::string all = ReadFile(input);
+    const std::string compressed = all.substr(all.find("\n\n") + 2);
+    REQUIRE(GzListMembers(compressed.data(), compressed.size(), members) == Z_OK);
+    REQUIRE(members.size() == 4);
+
+    const std::vector<std::string> args = {"--bins", "256", "--min", "0", "--max", "255"};
+    auto with = [&args](const char* gzip, bool pipeline = false){
+        std::vector<std::string> a = args;
+        a.insert(a.end(), {"--gzip", gzip});
+        if (pipeline){
+            a.push_back("--pipeline");
+        }
+        return a;
+    };
+    const std::string expected = HistogramOf(input, with("boost"));
+    REQUIRE(HistogramOf(input, with("gzio")) == expected);
+    REQUIRE(HistogramOf(input, with("gzio", true)) == expected);
+
+    // stored members whose data holds a gzip header: the split goes wrong, gzio inflates serially
+    std::string tricky = payload;
+    const char header[] = "\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff";
+    for (std::size_t at = 1000; at + sizeof(header) < tricky.size(); at += 100000){
+        tricky.replace(at, sizeof(header) - 1, header, sizeof(header) - 1);
+    }
+    const std::string fallback = WriteNrrd("members-tricky.nrrd", "uchar", tricky, 2, 0);
+    const std::string tricky_expected = HistogramOf(fallback, with("boost"));
+    REQUIRE(HistogramOf(fallback, with("gzio")) == tricky_expected);
+    REQUIRE(HistogramOf(fallback, with("gzio", true)) == tricky_expected);
+}
+
+TEST_CASE("Pipeline counts like the in memory histogram")
+{
+    const std::string members = WriteNrrd("pipeline-members.nrrd", "uchar", Values<std::uint8_t>(1 << 20, 0, 255), 3);
+    for (const std::string& input : {std::string("../res/sample.nrrd"), std::string("../res/uchar-raw.nrrd"), members}){
+        for (const char* gzip : {"boost", "gzio", "indexed", "speculative"}){
+            for (const char* bins : {"300", "3000000"}){
+                const std::vector<std::string> args = {"--gzip", gzip, "--bins", bins, "--min", "0", "--max", "255"};
+                std::vector<std::string> pipelined = args;
+                pipelined.push_back("--pipeline");
+                REQUIRE(HistogramOf(input, pipelined, "pipelined.txt") == HistogramOf(input, args));
+            }
+        }
+    }
+}
+
+TEST_CASE("Auto range counts like the range given explicitly")
+{
+    // 8 / 16 bit: per value count over the domain; wider: min / max scan, slices held (pipeline)
+    // or read twice (stream)
+    const std::vector<std::string> inputs = {
+        WriteNrrd("auto-uchar.nrrd", "uchar", Values<std::uint8_t>(200000, 3, 250), 2),
+        WriteNrrd("auto-short.nrrd", "short", Values<std::int16_t>(200000, -1234, 5678)),
+        WriteNrrd("auto-int.nrrd", "int", Values<std::int32_t>(200000, -70000, 900000), 1),
+        WriteNrrd("auto-float.nrrd", "float", Values<float>(200000, -2.5, 7.25)),
+    };
+    const std::vector<std::pair<const char*, const char*>> ranges = {
+        {"3", "250"}, {"-1234", "5678"}, {"-70000", "900000"}, {"-2.5", "7.25"},
+    };
+    for (std::size_t i = 0; i < inputs.size(); ++i){
+        const std::string expected = HistogramOf(inputs[i], {"--bins", "1000", "--min", ranges[i].first, "--max", ranges[i].second});
+        for (const std::vector<std::string>& mode : {std::vector<std::string>{}, {"--pipeline"}, {"--stream", "1"}}){
+            std::vector<std::string> args = {"--bins", "1000"};
+            args.insert(args.end(), mode.begin(), mode.end());
+            REQUIRE(HistogramOf(inputs[i], args, "auto.txt") == expected);
+        }
+    }
+}
+
+TEST_CASE("Truncated gzip payloads are rejected")
+{
+    const std::string payload = Values<std::uint8_t>(400000, 0, 255);
+    const std::string header = "NRRD0004\ntype: uchar\ndimension: 1\nsizes: 400000\nendian: little\nencoding: gzip\n\n";
+    const std::string first = GzipMember(payload.substr(0, 200000));
+    const std::string second = GzipMember(payload.substr(200000));
+    auto write = [](const std::string& name, const std::string& content){
+        std::ofstream(name, std::ios::binary | std::ios::trunc) << content;
+        std::remove((name + ".gzidx").c_str());
+        return name;
+    };
+    const std::vector<std::string> args = {"--bins", "256", "--min", "0", "--max", "255"};
+    auto with = [&args](const char* gzip){
+        std::vector<std::string> a = args;
+        a.insert(a.end(), {"--gzip", gzip});
+        return a;
+    };
+    const std::string expected = HistogramOf(WriteNrrd("truncated-raw.nrrd", "uchar", payload), args);
+
+    for (const char* gzip : {"gzio", "indexed", "speculative"}){
+        // cut inside the second member's header, or ending cleanly after the first member
+        for (const std::string& content : {header + first + second.substr(0, 10), header + first}){
+            const std::string input = write("truncated.nrrd", content);
+            std::remove("truncated.txt");
+            REQUIRE(HistogramOf(input, with(gzip), "truncated.txt").empty());
+            // nor is an index saved that would never load back
+            REQUIRE(!std::ifstream(input + ".gzidx").good());
+        }
+        // zero padding after the last member is not data
+        const std::string input = write("truncated.nrrd", header + first + second + std::string(64, '\0'));
+        REQUIRE(HistogramOf(input, with(gzip)) == expected);
+    }
+}
@@ -1,13 +1,97 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <functional>
 #include <iostream>
 #include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include "../hdr/Affinity.h"
+#include "../hdr/Executor.h"
+#include "../hdr/ThreadPool.h"
 
 // Template pattern for all task eg: compute histogram, quantize, convert , save etc..
 class Task
 {
 public:
-    static const std::size_t NO_OF_CORES;
+    // cpus the process may use (affinity mask, cgroup quota), fewer with Pinning::Physical
+    static std::size_t NO_OF_CORES;
+
+    // process wide workers for histogram, merge and decode tasks, started on first use. On a NUMA
+    // host each is pinned to the cpus of one node, split the way RkUtil::Numa::NodeOfWorker says,
+    // and within the node to one cpu of Pinned()'s order.
+    static RkUtil::ThreadPool& Pool(){
+
+        Started().store(true, std::memory_order_relaxed);
+        static RkUtil::ThreadPool pool(NO_OF_CORES, Placement());
+        return pool;
+    }
+
+    // the pipeline's consumers, up to NO_OF_CORES threads. They block on the pipeline's queue for
+    // as long as decoding runs, on Pool() they would leave the decoders' parallel loops
+    // (indexed, speculative, multi member inflate) without a free worker. Not pinned: with --pin
+    // Pool()'s workers hold one cpu each, a consumer pinned to one would share it with a decoder.
+    static RkUtil::ThreadPool& Consumers(){
+
+        Started().store(true, std::memory_order_relaxed);
+        static RkUtil::ThreadPool pool(NO_OF_CORES);
+        return pool;
+    }
+
+    // where the parallel loops of the tasks run, Pool() unless Use() picked another backend
+    static RkUtil::Executor& Exec(){
+
+        if (Backend() == RkUtil::ExecutionBackend::Tbb){
+            static RkUtil::TbbExecutor tbb;
+            return tbb;
+        }
+#ifdef RK_WITH_OPENMP
+        if (Backend() == RkUtil::ExecutionBackend::OpenMp){
+            static RkUtil::OmpExecutor omp;
+            return omp;
+        }
+#endif
+        static RkUtil::PoolExecutor pool(Pool(), NO_OF_CORES);
+        return pool;
+    }
+
+    static void Use(RkUtil::ExecutionBackend backend){
+
+#ifndef RK_WITH_OPENMP
+        if (backend == RkUtil::ExecutionBackend::OpenMp){
+            throw std::runtime_error("backend openmp needs a build configured with -DWITH_OPENMP=ON");
+        }
+#endif
+        Backend() = backend;
+    }
+
+    static RkUtil::ExecutionBackend Using(){
+
+        return Backend();
+    }
+
+    // how the workers get pinned, only until they are started
+    static void Pin(RkUtil::Pinning pinning){
+
+        if (pinning == Pinned()){
+            return;
+        }
+        if (Started().load(std::memory_order_relaxed)){
+            throw std::runtime_error("worker pinning cannot change once the workers run");
+        }
+        Pinned() = pinning;
+        if (pinning == RkUtil::Pinning::Physical){
+            std::size_t cores = 0;
+            for (const auto& node : RkUtil::Affinity::PinOrder(pinning, RkUtil::Numa::Topology())){
+                cores += node.size();
+            }
+            NO_OF_CORES = std::max<std::size_t>(std::min(NO_OF_CORES, cores), 1);
+        }
+    }
 
     virtual ~Task(){ }
 
@@ -29,6 +113,7 @@ public:
         end = std::chrono::high_resolution_clock::now();
         diff = std::chrono::duration_cast<std::chrono::milliseconds>(end-start);
         std::cout << "Operate completed in : " << diff.count() << " milliseconds." << std::endl;
+        auto counting = end - start;
 
         start = std::chrono::high_resolution_clock::now();
         WriteOutput();
@@ -36,13 +121,71 @@ public:
         diff = std::chrono::duration_cast<std::chrono::milliseconds>(end-start);
         std::cout << "WriteOutput completed in : " << diff.count() << " milliseconds." << std::endl;
 
+        // counting plus the reduction (WriteOutput() sums the partials), comparable across --backend
+        counting += end - start;
+        const double seconds = std::chrono::duration<double>(counting).count();
+        if (Volume() > 0 && seconds > 0){
+            std::cout << "Histogram throughput (" << BackendName() << " backend) : "
+                      << Volume() / seconds / (1 << 20) << " MB/s." << std::endl;
+        }
+
         return true;
     }
 
 #ifdef RUN_CATCH
-    virtual std::size_t OutputVal() = 0;
+    virtual std::uint64_t OutputVal() = 0;
 #endif
 
+protected:
+    // decoded bytes Operate() went through, 0 when not worth a throughput figure
+    virtual std::uint64_t Volume() const { return 0; }
+
+private:
+    // start hook of the pools: worker t on its node, pinned by Pinned()'s order
+    static std::function<void(std::size_t)> Placement(){
+
+        return [order = RkUtil::Affinity::PinOrder(Pinned(), RkUtil::Numa::Topology())](std::size_t t){
+            const RkUtil::Numa& numa = RkUtil::Numa::Topology();
+            const std::size_t node = RkUtil::Numa::NodeOfWorker(t, NO_OF_CORES, numa.Nodes());
+            if (!order[node].empty()){
+                const std::size_t k = t - RkUtil::Numa::FirstWorker(node, NO_OF_CORES, numa.Nodes());
+                RkUtil::Affinity::PinTo(order[node][k % order[node].size()]);
+            }else if (numa.Nodes() > 1){
+                numa.PinToNode(node);
+            }
+        };
+    }
+
+    static std::string BackendName(){
+
+        for (const auto& backend : RkUtil::ExecutionBackends){
+            if (backend.second == Backend()){
+                std::string name = backend.first;
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                return name;
+            }
+        }
+        return "?";
+    }
+
+    static RkUtil::Pinning& Pinned(){
+
+        static RkUtil::Pinning pinning = RkUtil::Pinning::None;
+        return pinning;
+    }
+
+    static std::atomic<RkUtil::ExecutionBackend>& Backend(){
+
+        static std::atomic<RkUtil::ExecutionBackend> backend{RkUtil::ExecutionBackend::Pool};
+        return backend;
+    }
+
+    static std::atomic<bool>& Started(){
+
+        static std::atomic<bool> started{false};
+        return started;
+    }
+
 protected:
     virtual bool ParseInput() = 0;
     virtual bool Operate() = 0;
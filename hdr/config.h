@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <map>
 #include <boost/program_options.hpp>
 #include <boost/program_options/options_description.hpp>
 
@@ -79,18 +80,35 @@ struct config_data {
     enum OUTPUT_HISTO_BIN_TYPE : uint8_t
     {
         TYPE_UINT_8_T, // unsigned char
-        TYPE_UINT_32_T // int
+        TYPE_UINT_32_T, // unsigned int
+        TYPE_UINT_64_T // unsigned long long
     };
-    std::uint16_t bins;
-    double min;
-    double max;
-    uint8_t type;
+    std::uint32_t bins;
+    double min;             // NaN unless given: lowest value found in the input
+    double max;             // NaN unless given: highest value found in the input
+    std::string type;       // output bin type, one of OUTPUT_HISTO_BIN_TYPE by name
     std::string input_file_name;
     std::string output_file_name;
+    bool pipeline;          // histogram decoded chunks while the rest is still being decoded
+    std::size_t stream;     // MiB of decode buffers in bounded memory streaming, 0: off
+    std::string gzip;       // gzip inflate backend: boost | gzio | indexed | speculative
+    std::string kernel;     // hot loop ISA variant: auto | scalar | avx2 | avx512
+    std::string pin;        // worker pinning: none | compact | scatter | physical
+    std::string backend;    // parallel loops on: pool | tbb | openmp
 };
 #pragma pack(pop)
 using RkConfig = config<config_data>;
 
+// every spelling -t takes: the NRRD type names and the fixed width ones
+static const std::map<std::string, config_data::OUTPUT_HISTO_BIN_TYPE> OutputHistoBinType = {
+    {"UCHAR", config_data::TYPE_UINT_8_T},
+    {"UINT8", config_data::TYPE_UINT_8_T},
+    {"UINT", config_data::TYPE_UINT_32_T},
+    {"UINT32", config_data::TYPE_UINT_32_T},
+    {"ULONGLONG", config_data::TYPE_UINT_64_T},
+    {"UINT64", config_data::TYPE_UINT_64_T},
+};
+
 template <typename DATA>
 std::ostream& operator<<(std::ostream& s, const config<DATA>& c) {
     for (auto &it : c.vm) {
@@ -111,6 +129,9 @@ std::ostream& operator<<(std::ostream& s, const config<DATA>& c) {
         else if (auto v = boost::any_cast<int>(&value)) {
             s << *v << std::endl;
         }
+        else if (auto v = boost::any_cast<bool>(&value)) {
+            s << std::boolalpha << *v << std::endl;
+        }
         else if (auto v = boost::any_cast<std::string>(&value)) {
             s << *v << std::endl;
         }
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <zlib.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+// Random access into a gzip payload, after zran.c from the zlib examples.
+// Inflating once with Z_BLOCK records an access point (bit exact input offset plus the
+// 32K window preceding it) every span bytes of output. Any range between two access
+// points can then be inflated on its own, i.e. in parallel with the others.
+namespace RkGzIndex {
+
+constexpr std::size_t WINDOW_SIZE = 32768;
+
+struct AccessPoint {
+    std::uint64_t out;                  // offset in the decoded payload
+    std::uint64_t in;                   // offset of the first full byte in the compressed payload
+    int bits;                           // bits of the byte before 'in' still to be consumed
+    std::vector<unsigned char> window;  // inflate dictionary at this point, empty at a member start
+};
+
+struct GzIndex {
+    std::uint64_t total_out = 0;
+    std::vector<AccessPoint> points;
+};
+
+using OutputSink = std::function<bool(const unsigned char*, std::size_t)>;
+
+// Inflate all gzip members in [in, in + in_len) feeding the output to sink, and record access
+// points at least span bytes of output apart. Every member start is an access point as well,
+// so a range never crosses a member boundary.
+int BuildIndex(const unsigned char* in, std::size_t in_len, std::uint64_t span,
+               GzIndex& index, const OutputSink& sink);
+
+// Inflate len bytes starting at access point 'from' into dst.
+int InflateRange(const unsigned char* in, std::size_t in_len, const AccessPoint& from,
+                 unsigned char* dst, std::size_t len);
+
+// Sidecar persistence. The index is only loaded back if it was built from the same compressed bytes,
+// decodes to total_out bytes and its points are consistent; false (and an empty index) otherwise.
+bool SaveIndex(const std::string& path, const GzIndex& index,
+               const unsigned char* in, std::size_t in_len);
+bool LoadIndex(const std::string& path, const unsigned char* in, std::size_t in_len,
+               std::uint64_t total_out, GzIndex& index);
+
+}
@@ -2,8 +2,29 @@
 
 #include <zlib.h> /* NrrdIO-hack-004 */
 #include <stdio.h>
+#include <vector>
 
 gzFile GzOpen(FILE* fd, const char *mode);
+/* read-only stream which inflates directly out of len bytes at data */
+gzFile GzOpenMem(const void* data, size_t len);
 int GzClose(gzFile file);
-int GzRead(gzFile file, void* buf, unsigned int len,
-                       unsigned int* read);
+int GzRead(gzFile file, void* buf, size_t len, size_t* read);
+/* first byte of the in-memory source not yet inflated, NULL for file streams */
+const void* GzInputPosition(gzFile file);
+
+/* one member of a concatenated (pigz, bgzip...) gzip payload */
+typedef struct {
+  size_t in;   /* offset of the member's header */
+  size_t len;  /* compressed length, header and trailer included */
+  size_t out;  /* offset of its output in the whole decoded payload */
+  size_t size; /* decoded length, as recorded in its trailer */
+} GzMember;
+
+/* split len bytes at data into members without inflating them. BGZF blocks
+ * are walked by their BSIZE, other members are found by scanning for the
+ * next header. A split that is wrong only shows when the members are
+ * inflated, GzInflateMember() then fails. */
+int GzListMembers(const void* data, size_t len, std::vector<GzMember>& members);
+/* inflate one member into dst (member->size bytes), checking its crc and that
+ * it ends exactly at member->in + member->len */
+int GzInflateMember(const void* data, const GzMember* member, void* dst);
@@ -11,6 +11,7 @@
 #include <deque>
 #include <execution>
 #include <atomic>
+#include <cmath>
 
 #include <boost/interprocess/file_mapping.hpp>
 
@@ -18,22 +19,66 @@
 #include "../hdr/config.h"
 #include "../hdr/Encoders.h"
 #include "../hdr/Utility.h"
+#include "../hdr/Kernels.h"
 
 class ComputeHistogram : public Task{
 
-    // Must use some factory method to generate this varaible for type and size based on config
-    using bins_output_type = std::uint32_t;
-    using bins_type = RkUtil::ScopedStaticVector<bins_output_type, RkUtil::MAX_HIST_BIN_SIZE>;
+    // the kernels count into 32 bit, see Tally; the totals are 64 bit, volumes go past 4G voxels
+    using count_type = std::uint32_t;
+    using bins_output_type = std::uint64_t;
+    using bins_type = RkUtil::ScopedStaticVector<bins_output_type>;
 
 public:
     explicit ComputeHistogram(const std::unique_ptr<RkConfig>& config)
         : m_Config(config) {
 
         // exit if cannot operate. RAII.
-        if (m_Config->data().bins < m_Config->data().max){
-            throw std::runtime_error("bins must be >= max value to represent");
+        if (m_Config->data().bins == 0 || m_Config->data().bins > RkUtil::MAX_HIST_BIN_SIZE){
+            throw std::runtime_error("bins must be in 1.." + std::to_string(RkUtil::MAX_HIST_BIN_SIZE));
+        }
+        // NaN: not given, taken from the data
+        if (!(m_Config->data().min < m_Config->data().max) &&
+                !std::isnan(m_Config->data().min) && !std::isnan(m_Config->data().max)){
+            throw std::runtime_error("min must be < max");
         }
         m_Bins = m_Config->data().bins;
+
+        auto backend = RkEncoders::GzipBackends.find(RkUtil::str_toupper(m_Config->data().gzip));
+        if (backend == RkEncoders::GzipBackends.end()){
+            throw std::runtime_error("unknown gzip backend: " + m_Config->data().gzip);
+        }
+        m_GzipBackend = backend->second;
+
+        auto output_type = OutputHistoBinType.find(RkUtil::str_toupper(m_Config->data().type));
+        if (output_type == OutputHistoBinType.end()){
+            throw std::runtime_error("unknown output type: " + m_Config->data().type);
+        }
+        m_OutputMax = OutputMax(output_type->second);
+
+        auto pinning = RkUtil::Pinnings.find(RkUtil::str_toupper(m_Config->data().pin));
+        if (pinning == RkUtil::Pinnings.end()){
+            throw std::runtime_error("unknown pinning: " + m_Config->data().pin);
+        }
+        Pin(pinning->second);
+
+        auto execution = RkUtil::ExecutionBackends.find(RkUtil::str_toupper(m_Config->data().backend));
+        if (execution == RkUtil::ExecutionBackends.end()){
+            throw std::runtime_error("unknown backend: " + m_Config->data().backend);
+        }
+        Use(execution->second);
+
+        // hot loops: best variant the CPU has unless --kernel says otherwise
+        const RkKernels::Isa best = RkKernels::DetectIsa();
+        RkKernels::Isa isa = best;
+        const std::string& kernel = m_Config->data().kernel;
+        if (kernel != "auto" && !RkKernels::ParseIsa(kernel, isa)){
+            throw std::runtime_error("unknown kernel: " + kernel);
+        }
+        if (isa > best){
+            throw std::runtime_error(std::string("kernel ") + RkKernels::IsaName(isa) + " not supported by this CPU");
+        }
+        RkKernels::SelectIsa(isa);
+        std::cout << "kernel: " << RkKernels::IsaName(isa) << " (cpu: " << RkKernels::IsaName(best) << ")" << std::endl;
     }
 
     bool ParseInput() override{
@@ -57,7 +102,12 @@ public:
                 continue;
 
             if (RkUtil::str_toupper(vals[0]) == "TYPE"){
-                m_Type = RkUtil::PayLoadType[RkUtil::str_toupper(vals[1])];
+                auto itr = RkUtil::PayLoadType.find(RkUtil::str_toupper(vals[1]));
+                if (itr == RkUtil::PayLoadType.end()){
+                    std::cerr << "Invalid type: " << vals[1] << " not (yet) supported" << std::endl;
+                    return false;
+                }
+                m_Type = itr->second;
                 continue;
             }
 
@@ -78,7 +128,7 @@ public:
                 std::generate(m_Sizes.begin(), m_Sizes.end(), [n = 0, s]() mutable{
                     std::size_t v = 0;
                     try{
-                        v = std::stoi(s[n++]);
+                        v = std::stoull(s[n++]);
                     }catch(...){
                         v = 1;
                     }
@@ -88,6 +138,16 @@ public:
                 continue;
             }
 
+            if (RkUtil::str_toupper(vals[0]) == "ENDIAN"){
+                const std::string endian = RkUtil::str_toupper(vals[1]);
+                if (endian != "BIG" && endian != "LITTLE"){
+                    std::cerr << "Invalid endian: " << vals[1] << std::endl;
+                    return false;
+                }
+                m_ByteSwap = (endian == "BIG") != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+                continue;
+            }
+
             if (RkUtil::str_toupper(vals[0]) == "ENCODING"){
                 auto itr = RkEncoders::Encoders.find(RkUtil::str_toupper(vals[1]));
                 if (itr == RkEncoders::Encoders.end()){
@@ -108,8 +168,41 @@ public:
             return false;
         }
 
-        if (!m_Encoder->Parse(input_file_stream, input_file_name,
-                              (m_DataSize * RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]), m_DecompressedData)){
+        // payload type is known from here on: pick the inner loop once for the whole input
+        if (!AutoRange()){
+            if (!MakeKernel(RkKernels::Range{m_Config->data().min, m_Config->data().max})){
+                return false;
+            }
+        }else if ((m_DomainKernel = RkKernels::MakeDomainKernel<std::uint64_t>(m_Type, m_DomainSize, m_DomainLowest))){
+            if (Swap()){
+                m_DomainKernel = RkKernels::SwapKernel(std::move(m_DomainKernel), RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+            }
+        }else{
+            m_RangeScanner = RkKernels::MakeRangeScanner(m_Type);
+            if (Swap()){
+                m_RangeScanner = RkKernels::SwapScanner(std::move(m_RangeScanner), RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+            }
+        }
+
+        if (Pipelined()){
+            return StreamInput(input_file_stream, input_file_name);
+        }
+
+        if (m_RangeScanner && !m_Encoder->ZeroCopy()){
+            // min / max of every chunk right after it was inflated, while it is still in cache
+            const std::size_t jump = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+            const bool ok = m_Encoder->Stream(input_file_stream, input_file_name,
+                                              DecodeOptions(std::max(PIPELINE_CHUNK_SIZE - (PIPELINE_CHUNK_SIZE % jump), jump)),
+                                              [this](RkUtil::PayloadSlice&& slice){
+                m_RangeScanner(slice.view(), m_DataRange);
+                m_DecompressedData.push_back(std::move(slice));
+                return true;
+            });
+            if (!ok){
+                return false;
+            }
+            m_RangeScanned = true;
+        }else if (!m_Encoder->Parse(input_file_stream, input_file_name, DecodeOptions(0), m_DecompressedData)){
             return false;
         }
 
@@ -119,47 +212,24 @@ public:
 
     bool Operate() override{
 
-        try{
-            /*
-             * Not good idea to Operate() while Parse() in action because
-             * # if mid data is corrupted Operate() on previous data goes stale
-             * Not a good idea to read the file with multiple threads as disk reading HW needle
-             * is still one which might have to jump sectors and worsen performance.
-             * or memory map the whole file will exhaust memory if file is too large (can shrink though).
-            */
-            for (std::string& slice : m_DecompressedData){
-                std::size_t individual_buffer_size = (slice.size() / NO_OF_CORES);
-                boost::interprocess::offset_t offset = 0;
-                const std::size_t datasize = slice.size();
-                for(uint i = 1; i <= NO_OF_CORES; i++, offset += individual_buffer_size){
-                    if(i == NO_OF_CORES){
-                        individual_buffer_size = datasize - ((i-1) * individual_buffer_size);
-                    }
+        // pipelined input is already being histogrammed by the stage started in ParseInput()
+        if (Pipelined()){
+            return true;
+        }
 
-                    const char* start = (slice.data() + offset);
-                    std::string_view tmp(start, individual_buffer_size);
-                    const auto min = m_Config->data().min;
-                    const auto max = m_Config->data().max;
-                    const auto jump = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
-                    auto fu = std::async(std::launch::async, [min, max, jump, this, data = tmp]() mutable{
-
-                        bins_type hist(m_Bins);
-                        for (std::size_t idx = 0; idx < data.size(); idx += jump) {
-                            auto val = DecodeBytes(data, idx);
-                            // TODO: caution!!.
-                            // strictly validate for extents because hist[] is pre allocated based on bins.
-                            // must implement minmax
-                            val = RkUtil::Clamp(min, val, max);
-                            hist[val] += 1;
-                        }
-
-                        hist.canRelease(false);
-                        return hist;
-                    });
-
-                    m_Futures.push_back(std::move(fu));
+        try{
+            if (m_DomainKernel){
+                return CountDomain();
+            }
+            if (m_RangeScanner){
+                if (!m_RangeScanned){
+                    ScanRange();
+                }
+                if (!MakeKernel(m_DataRange)){
+                    return false;
                 }
             }
+            Histogram();
         }catch(std::exception& ex){
             std::cout << "exception occured while computing histogram: why?: " << ex.what() << std::endl;
             return false;
@@ -195,47 +265,31 @@ public:
          * Maybe I will submit another solution in '*.cu' with only the kernel function later.
         */
 
-        bins_type ret;
-        while(!m_Futures.empty()){
-            auto& fu1 = m_Futures.front();
-            ret = fu1.get();
-            m_Futures.pop_front();
-
-            if (m_Futures.empty())
-                break;
-
-            std::promise<bins_type> merge_promise;
-            std::future<bins_type> merge_future = merge_promise.get_future();
-            auto mergefu = std::async(std::launch::async, [this, first = std::move(ret), second = std::move(merge_future)]() mutable{
-                auto other = second.get();
-                bins_type ret(m_Bins);
-                assert(first->size() == other->size());
-                const auto start = ret.begin();
-                std::for_each (std::execution::par_unseq, ret.begin(), ret.end(),
-                               [&ret, first, other, start](const bins_output_type& e)
-                {
-                    const auto index = &e - &start[0];
-                    ret[index] = first[index] + other[index];
-                });
-                first.canRelease(true);
-                other.canRelease(true);
-
-                ret.canRelease(false);
-                return ret;
-            });
-
-            m_Futures.push_back(std::move(mergefu));
-            auto& fu2 = m_Futures.front();
-            merge_promise.set_value(fu2.get());
+        std::vector<bins_type> parts;
+        while (!m_Futures.empty()){
+            parts.push_back(m_Futures.front().get());
             m_Futures.pop_front();
         }
+        if (parts.empty()){
+            parts.emplace_back(m_Bins);
+        }
+        std::vector<bins_output_type*> sums;
+        for (bins_type& part : parts){
+            assert(part->size() == m_Bins);
+            sums.push_back(part.begin());
+        }
+        Reduce(sums, m_Bins);
+        for (std::size_t i = 1; i < parts.size(); ++i){
+            parts[i].canRelease(true);
+        }
+        bins_type ret = std::move(parts.front());
 
-        // Copy the output for unit test
+        // Copy the output for unit test. Counts past what -t holds saturate.
         std::ofstream output(m_Config->data().output_file_name);
-        const auto s = ret->size();
+        const std::size_t s = m_Bins;
         m_Output.resize(s);
         for (std::size_t i = 0; i < s; ++i){
-            const auto& c = ret[i];
+            const auto c = std::min(ret[i], m_OutputMax);
             m_Output[i] = c;
             output << "(" << i << ", " << c << ")" << '\n';
         }
@@ -249,39 +303,685 @@ public:
 #endif
     }
 
+protected:
+    std::uint64_t Volume() const override{
+
+        // pipelined input is counted while it is parsed, Operate() has nothing left to time
+        return Pipelined() ? 0 : m_DataSize * RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+    }
+
+public:
 #ifdef RUN_CATCH
-    std::size_t OutputVal(){
+    std::uint64_t OutputVal(){
 
-        return std::accumulate(m_Output.begin(), m_Output.end(), 0);
+        return std::accumulate(m_Output.begin(), m_Output.end(), std::uint64_t(0));
     }
 #endif
 
 private:
 
-    double DecodeBytes(const std::string_view& data, std::size_t index){
+    /*
+     * A worker's counts. The kernels increment 32 bit counters, half the footprint of 64 bit ones
+     * (see the residency tiers in Kernels.h), and those are carried into the 64 bit totals before
+     * 2^32 voxels went into them, so no counter can wrap however big the volume.
+    */
+    class Tally{
+    public:
+        Tally(std::size_t bins, std::size_t jump)
+            : m_Counts(bins),
+              m_Total(bins),
+              m_Bins(bins),
+              m_Jump(jump) {}
+
+        // the buffers are pooled, a copy would hand them back twice
+        Tally(const Tally&) = delete;
+        Tally& operator=(const Tally&) = delete;
+        Tally(Tally&&) = default;
+
+#ifdef RK_WITH_OPENMP
+        // an empty tally of the same shape, the private copy of an OpenMP reduction
+        Tally Fresh() const{
+
+            return Tally(m_Bins, m_Jump);
+        }
+
+        // in's counts, carried or not, added to the totals; in is left as it was
+        void Absorb(const Tally& in){
 
-        switch (RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]) {
+            bins_output_type* total = m_Total.begin();
+            const bins_output_type* other = in.m_Total.begin();
+            const count_type* counts = in.m_Counts.begin();
+#pragma omp simd
+            for (std::size_t b = 0; b < m_Bins; ++b){
+                total[b] += other[b] + counts[b];
+            }
+            m_Counted = m_Counted || in.m_Counted;
+        }
+#endif
+
+        void Count(const RkKernels::Kernel<count_type>& kernel, std::string_view data){
+
+            m_Counted = true;
+            while (!data.empty()){
+                if (m_Pending == CARRY_VOXELS){
+                    Carry();
+                }
+                const std::size_t n = std::min<std::uint64_t>(data.size(), (CARRY_VOXELS - m_Pending) * m_Jump);
+                kernel(data.substr(0, n), m_Counts.begin());
+                m_Pending += n / m_Jump;
+                data.remove_prefix(n);
+            }
+        }
+
+        bool Counted() const { return m_Counted; }
+
+        bins_type Total(){
+
+            Carry();
+            m_Total.canRelease(false);
+            return std::move(m_Total);
+        }
+
+    private:
+        void Carry(){
 
-        case 1:         //uchar
-            return RkUtil::DecodeBytesSpcialized<uint8_t>(data, index);
-            break;
-        case 2:         // short
-            return RkUtil::DecodeBytesSpcialized<int16_t>(data, index);
-            break;
+            for (std::size_t b = 0; b < m_Bins; ++b){
+                m_Total[b] += m_Counts[b];
+            }
+            m_Counts->clear();
+            m_Pending = 0;
+        }
+
+        static constexpr std::uint64_t CARRY_VOXELS = std::numeric_limits<count_type>::max();
+
+        RkUtil::ScopedStaticVector<count_type> m_Counts;
+        bins_type m_Total;
+        std::size_t m_Bins;
+        std::size_t m_Jump;
+        std::uint64_t m_Pending = 0;
+        bool m_Counted = false;
+    };
+
+#ifdef RK_WITH_OPENMP
+#pragma omp declare reduction(absorb : Tally : omp_out.Absorb(omp_in)) initializer(omp_priv = omp_orig.Fresh())
+#endif
+
+    /*
+     * Sums the partial histograms into parts[0]. The bins are cut into REDUCE_BLOCK_BINS blocks and
+     * every block is a task of its own, which adds that block of up to REDUCE_FAN_IN partials: the
+     * block of the first stays in L1 while the others stream past, and the tasks spread over all
+     * workers however few partials there are. More partials than REDUCE_FAN_IN are summed in groups
+     * of that many first, then the groups' sums, ... a log depth tree, so no task reads from
+     * hundreds of arrays at once.
+     *
+     * On a NUMA host the partials of each node are summed first, by that node's workers, and only
+     * the per node sums cross the interconnect, in one last merge.
+    */
+    template<typename Counter>
+    void Reduce(std::vector<Counter*> parts, std::size_t bins){
+
+        const RkUtil::Numa& numa = RkUtil::Numa::Topology();
+        std::vector<std::vector<Counter*>> local(numa.Nodes());
+        for (Counter* part : parts){
+            local[numa.NodeOf(part)].push_back(part);
         }
+        ReduceSets(local, bins);
+
+        // parts[0] heads its node's set, it takes the other nodes' sums
+        std::vector<std::vector<Counter*>> across(1, std::vector<Counter*>(1, parts[0]));
+        for (const auto& set : local){
+            if (!set.empty() && set[0] != parts[0]){
+                across[0].push_back(set[0]);
+            }
+        }
+        ReduceSets(across, bins);
+    }
+
+    // Reduce() of every sets[node] into sets[node][0], the tasks of each set preferably on its node
+    template<typename Counter>
+    void ReduceSets(std::vector<std::vector<Counter*>>& sets, std::size_t bins){
+
+        const std::size_t blocks = (bins + REDUCE_BLOCK_BINS - 1) / REDUCE_BLOCK_BINS;
+        std::vector<std::size_t> tasks(sets.size());
+        for (;;){
+            std::size_t total = 0;
+            for (std::size_t n = 0; n < sets.size(); ++n){
+                tasks[n] = sets[n].size() > 1 ? (sets[n].size() + REDUCE_FAN_IN - 1) / REDUCE_FAN_IN * blocks : 0;
+                total += tasks[n];
+            }
+            if (total == 0){
+                break;
+            }
+            Exec().ParallelForNodes(tasks, [&sets, bins, blocks](std::size_t node, std::size_t task){
+                const std::vector<Counter*>& parts = sets[node];
+                const std::size_t first = (task / blocks) * REDUCE_FAN_IN;
+                const std::size_t count = std::min(REDUCE_FAN_IN, parts.size() - first) - 1;
+                const std::size_t lo = (task % blocks) * REDUCE_BLOCK_BINS;
+                const std::size_t n = std::min(REDUCE_BLOCK_BINS, bins - lo);
+                Counter* srcs[REDUCE_FAN_IN];
+                for (std::size_t s = 0; s < count; ++s){
+                    srcs[s] = parts[first + 1 + s] + lo;
+                }
+                RkKernels::SumCounts(parts[first] + lo, srcs, count, n);
+            });
+            for (std::vector<Counter*>& parts : sets){
+                const std::size_t groups = (parts.size() + REDUCE_FAN_IN - 1) / REDUCE_FAN_IN;
+                for (std::size_t g = 0; g < groups; ++g){
+                    parts[g] = parts[g * REDUCE_FAN_IN];
+                }
+                parts.resize(groups);
+            }
+        }
+    }
+
+    static std::uint64_t OutputMax(config_data::OUTPUT_HISTO_BIN_TYPE type){
+
+        switch (type){
+        case config_data::TYPE_UINT_8_T: return std::numeric_limits<std::uint8_t>::max();
+        case config_data::TYPE_UINT_32_T: return std::numeric_limits<std::uint32_t>::max();
+        case config_data::TYPE_UINT_64_T: break;
+        }
+        return std::numeric_limits<std::uint64_t>::max();
+    }
+
+    // payload written with the other byte order, single byte types need no swap
+    bool Swap() const{
+
+        return m_ByteSwap && RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type] > 1;
+    }
+
+    // --stream is the pipeline with its decode buffers bounded
+    bool Pipelined() const{
+
+        return m_Config->data().pipeline || m_Config->data().stream > 0;
+    }
+
+    bool AutoRange() const{
+
+        return std::isnan(m_Config->data().min) || std::isnan(m_Config->data().max);
+    }
+
+    /*
+     * Not good idea to Operate() while Parse() in action because
+     * # if mid data is corrupted Operate() on previous data goes stale
+     * Not a good idea to read the file with multiple threads as disk reading HW needle
+     * is still one which might have to jump sectors and worsen performance.
+     * or memory map the whole file will exhaust memory if file is too large (can shrink though).
+     *
+     * The decoded slices, however many and however uneven, are cut into chunks of whole values
+     * which the executor folds into states, one per Exec().Concurrency(): the pool by work
+     * stealing (see RkUtil::PoolExecutor), TBB by its auto partitioner, OpenMP by a dynamic schedule.
+    */
+    template<typename State, typename Fold>
+    void Schedule(std::vector<State>& states, std::size_t chunk_size, Fold fold){
+
+        assert(states.size() == Exec().Concurrency());
+        std::vector<std::size_t> nodes;
+        const std::vector<std::string_view> chunks = Chunks(chunk_size, nodes);
+        Exec().Fold(nodes, [&chunks, &states, &fold](std::size_t chunk, std::size_t slot){
+            fold(chunks[chunk], states[slot]);
+        });
+    }
+
+    // the decoded slices cut into chunks of whole values, nodes[i] the NUMA node holding chunk i
+    std::vector<std::string_view> Chunks(std::size_t chunk_size, std::vector<std::size_t>& nodes) const{
+
+        const RkUtil::Numa& numa = RkUtil::Numa::Topology();
+        const std::size_t jump = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+        const std::size_t step = std::max(chunk_size - (chunk_size % jump), jump);
+        std::vector<std::string_view> chunks;
+        for (const RkUtil::PayloadSlice& slice : m_DecompressedData){
+            for (std::string_view rest = slice.view(); !rest.empty(); rest.remove_prefix(std::min(step, rest.size()))){
+                chunks.push_back(rest.substr(0, step));
+                nodes.push_back(numa.NodeOf(rest.data()));
+            }
+        }
+        return chunks;
+    }
+
+    // Chunks big enough that the kernels' per call setup (sub histograms, narrow counters) pays.
+    std::size_t ChunkSize() const{
+
+        return std::max(SCHEDULE_CHUNK_SIZE, 4 * std::size_t(m_Bins) * RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+    }
+
+    // views cut into (at most) parts runs of whole values of about equal size
+    std::vector<std::vector<std::string_view>> Cut(const std::vector<std::string_view>& views, std::size_t parts) const{
+
+        const std::size_t jump = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+        std::size_t total = 0;
+        for (const std::string_view& view : views){
+            total += view.size();
+        }
+        std::size_t share = total / parts;
+        share = std::max(share - (share % jump), jump);
+
+        std::vector<std::vector<std::string_view>> shares(1);
+        std::size_t left = share;
+        for (const std::string_view& view : views){
+            for (std::string_view rest = view; !rest.empty(); ){
+                if (left == 0 && shares.size() < parts){
+                    shares.emplace_back();
+                    left = share;
+                }
+                // the last share takes whatever is left
+                const std::size_t n = shares.size() == parts ? rest.size() : std::min(left, rest.size());
+                shares.back().push_back(rest.substr(0, n));
+                rest.remove_prefix(n);
+                left -= std::min(left, n);
+            }
+        }
+        return shares;
+    }
+
+    void Histogram(){
+
+        if (m_IndexKernel){
+            // fans out on the pool itself, so it runs here rather than as a task waiting on tasks
+            std::promise<bins_type> ready;
+            ready.set_value(PartitionedHistogram());
+            m_Futures.push_back(ready.get_future());
+            return;
+        }
+#ifdef RK_WITH_OPENMP
+        if (Using() == RkUtil::ExecutionBackend::OpenMp){
+            ReducedHistogram();
+            return;
+        }
+#endif
+        std::vector<Tally> tallies;
+        tallies.reserve(Exec().Concurrency());
+        for (std::size_t i = 0; i < Exec().Concurrency(); ++i){
+            tallies.emplace_back(m_Bins, RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+        }
+        Schedule(tallies, ChunkSize(), [this](const std::string_view& chunk, Tally& tally){
+            tally.Count(m_Kernel, chunk);
+        });
+        for (Tally& tally : tallies){
+            // slots no thread came to (TBB) would only add zeros
+            if (!tally.Counted()){
+                continue;
+            }
+            std::promise<bins_type> ready;
+            ready.set_value(tally.Total());
+            m_Futures.push_back(ready.get_future());
+        }
+    }
+
+#ifdef RK_WITH_OPENMP
+    /*
+     * --backend openmp: the per thread tallies are an OpenMP array reduction (see the declare
+     * reduction next to Tally) rather than slots of our own. Each thread of the team counts its
+     * dynamically scheduled chunks into a private Fresh() tally, the runtime then Absorb()s those
+     * into the one tally here, the bins summed with simd adds. A single histogram is left for
+     * WriteOutput(), the same counts as the other backends', only summed in another order.
+    */
+    void ReducedHistogram(){
+
+        std::vector<std::size_t> nodes;
+        const std::vector<std::string_view> chunks = Chunks(ChunkSize(), nodes);
+        const std::int64_t n = chunks.size();
+        Tally tally(m_Bins, RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+#pragma omp parallel for schedule(dynamic) reduction(absorb : tally)
+        for (std::int64_t i = 0; i < n; ++i){
+            tally.Count(m_Kernel, chunks[i]);
+        }
+        std::promise<bins_type> ready;
+        ready.set_value(tally.Total());
+        m_Futures.push_back(ready.get_future());
+    }
+#endif
+
+    /*
+     * Counters far bigger than L2: radix partitioned two pass histogram (RkKernels::RadixPartition),
+     * one shared histogram instead of one per worker. The payload is taken RADIX_ROUND_VOXELS at a
+     * time so the partitioned bins stay bounded; per round the workers first partition their share,
+     * then count a share of the buckets each.
+    */
+    bins_type PartitionedHistogram(){
+
+        const std::size_t jump = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+        std::vector<std::string_view> views;
+        std::size_t total = 0;
+        for (const RkUtil::PayloadSlice& slice : m_DecompressedData){
+            views.push_back(slice.view());
+            total += slice.size();
+        }
+
+        bins_type hist(m_Bins);
+        const std::size_t rounds = std::max<std::size_t>(1, (total / jump + RADIX_ROUND_VOXELS - 1) / RADIX_ROUND_VOXELS);
+        std::vector<RkKernels::RadixPartition> partitions;
+        for (std::size_t w = 0; w < Exec().Concurrency(); ++w){
+            partitions.emplace_back(m_RadixPlan);
+        }
+        for (const auto& round : Cut(views, rounds)){
+            const auto shares = Cut(round, Exec().Concurrency());
+            Exec().ParallelFor(shares.size(), [this, jump, &partitions, &shares](std::size_t w){
+                RkKernels::RadixPartition& partition = partitions[w];
+                const std::vector<std::string_view>& share = shares[w];
+                std::size_t voxels = 0;
+                for (const std::string_view& data : share){
+                    voxels += data.size() / jump;
+                }
+                partition.Clear();
+                partition.Reserve(voxels);
+                std::vector<RkKernels::BinIndex> bins(RADIX_BLOCK_VOXELS);
+                for (const std::string_view& data : share){
+                    for (std::size_t pos = 0; pos < data.size(); pos += RADIX_BLOCK_VOXELS * jump){
+                        const std::string_view block = data.substr(pos, RADIX_BLOCK_VOXELS * jump);
+                        m_IndexKernel(block, bins.data());
+                        partition.Add(bins.data(), block.size() / jump);
+                    }
+                }
+                partition.Flush();
+            });
+            // shares past the last one Cut() made were never filled this round
+            const std::size_t used = shares.size();
+
+            // buckets cover disjoint counters: no two workers touch the same one
+            const std::size_t workers = std::min<std::size_t>(Exec().Concurrency(), m_RadixPlan.buckets);
+            Exec().ParallelFor(workers, [this, workers, used, &partitions, &hist](std::size_t w){
+                for (std::size_t b = w; b < m_RadixPlan.buckets; b += workers){
+                    for (std::size_t p = 0; p < used; ++p){
+                        RkKernels::CountBucket(partitions[p].Bucket(b), hist.begin());
+                    }
+                }
+            });
+        }
+
+        hist.canRelease(false);
+        return hist;
+    }
+
+    // Parallel min / max over data that was not scanned while decoding (raw payloads).
+    void ScanRange(){
+
+        std::vector<RkKernels::Range> ranges(Exec().Concurrency());
+        Schedule(ranges, SCHEDULE_CHUNK_SIZE, [this](const std::string_view& chunk, RkKernels::Range& range){
+            m_RangeScanner(chunk, range);
+        });
+        for (const RkKernels::Range& range : ranges){
+            m_DataRange.Merge(range);
+        }
+    }
+
+    bool CountDomain(){
+
+        std::vector<std::vector<std::uint64_t>> counts(Exec().Concurrency(), std::vector<std::uint64_t>(m_DomainSize, 0));
+        Schedule(counts, std::max(SCHEDULE_CHUNK_SIZE, 4 * m_DomainSize * RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]),
+                 [this](const std::string_view& chunk, std::vector<std::uint64_t>& count){
+            m_DomainKernel(chunk, count.data());
+        });
+        std::vector<std::uint64_t*> sums;
+        for (auto& count : counts){
+            sums.push_back(count.data());
+        }
+        Reduce(sums, m_DomainSize);
+        return Rebin(counts[0]);
+    }
+
+    // Domain counts to the histogram, over the range where the counts are non zero.
+    bool Rebin(const std::vector<std::uint64_t>& total){
+
+        RkKernels::Range range;
+        for (std::size_t i = 0; i < m_DomainSize; ++i){
+            if (total[i]){
+                range.Merge(RkKernels::Range{m_DomainLowest + i, m_DomainLowest + i});
+            }
+        }
+        const auto bins = RkKernels::DomainBins(m_Type, ResolveRange(range), m_Bins);
+        if (bins.empty()){
+            return false;
+        }
+
+        bins_type hist(m_Bins);
+        for (std::size_t i = 0; i < m_DomainSize; ++i){
+            hist[bins[i]] += total[i];
+        }
+        hist.canRelease(false);
+        std::promise<bins_type> ready;
+        ready.set_value(std::move(hist));
+        m_Futures.push_back(ready.get_future());
+        return true;
+    }
+
+    // -min / -max as given, the data's extent where not. Never empty, even for constant data.
+    RkKernels::Range ResolveRange(const RkKernels::Range& data) const{
+
+        const bool auto_min = std::isnan(m_Config->data().min);
+        const bool auto_max = std::isnan(m_Config->data().max);
+        RkKernels::Range range{auto_min ? data.min : m_Config->data().min,
+                               auto_max ? data.max : m_Config->data().max};
+        if (!data.Valid()){
+            // nothing but NaN (or nothing at all)
+            range.min = auto_min ? (auto_max ? 0.0 : range.max - 1) : range.min;
+            range.max = auto_max ? range.min + 1 : range.max;
+        }
+        if (!(range.min < range.max)){
+            if (auto_max){
+                range.max = std::max(range.min + 1, std::nextafter(range.min, HUGE_VAL));
+            }else{
+                range.min = std::min(range.max - 1, std::nextafter(range.max, -HUGE_VAL));
+            }
+        }
+        if (AutoRange()){
+            std::cout << "histogram range: [" << range.min << ", " << range.max << "]" << std::endl;
+        }
+        return range;
+    }
+
+    bool MakeKernel(const RkKernels::Range& data){
+
+        const RkKernels::Range range = ResolveRange(data);
+        m_Kernel = RkKernels::MakeKernel<count_type>(m_Type, range.min, range.max, m_Bins);
+        if (!m_Kernel){
+            std::cerr << "Cannot bin [" << range.min << ", " << range.max << "] into "
+                      << m_Bins << " bins" << std::endl;
+            return false;
+        }
+        if (Swap()){
+            m_Kernel = RkKernels::SwapKernel(std::move(m_Kernel), RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+        }
+        // the pipeline folds chunks as they come, it has no second pass. Radix counts straight into
+        // the 64 bit totals.
+        if (!Pipelined() && RkKernels::PlanRadix(m_Bins, sizeof(bins_output_type), Exec().Concurrency(), m_RadixPlan)){
+            m_IndexKernel = RkKernels::MakeKernel<RkKernels::BinIndex>(m_Type, range.min, range.max, m_Bins);
+            if (Swap()){
+                m_IndexKernel = RkKernels::SwapKernel(std::move(m_IndexKernel), RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Pipeline mode: decoding and histogramming overlap instead of running back to back.
+     * The encoder pushes fixed size chunks into a bounded queue while it inflates and
+     * NO_OF_CORES workers pull from it, each folding chunks into its own partial histogram
+     * as they finish. WriteOutput() then merges NO_OF_CORES partials as usual.
+     * Latency becomes ~max(decode, histogram) rather than their sum and at most
+     * PIPELINE_QUEUE_DEPTH chunks of decoded data are in flight.
+     * Exception: an auto range over a payload wider than 16 bit, which needs all of the data
+     * scanned before the first value can be binned.
+     *
+     * With --stream <MiB> the chunks are decoded into a fixed ring of buffers within that budget
+     * (see Consume()) and nothing is held on to, so peak memory no longer grows with the volume:
+     * a wide auto range then reads the input twice, once for the range and once to count.
+    */
+    bool StreamInput(std::ifstream& input_file_stream, const std::string& input_file_name){
+
+        if (m_DomainKernel){
+            // one pass after all: per value counts don't depend on the range
+            std::vector<std::vector<std::uint64_t>> counts(NO_OF_CORES, std::vector<std::uint64_t>(m_DomainSize, 0));
+            if (!Consume(input_file_stream, input_file_name, counts, [this](const RkUtil::PayloadSlice& slice, std::vector<std::uint64_t>& count){
+                m_DomainKernel(slice.view(), count.data());
+            })){
+                return false;
+            }
+            std::vector<std::uint64_t*> sums;
+            for (auto& count : counts){
+                sums.push_back(count.data());
+            }
+            Reduce(sums, m_DomainSize);
+            return Rebin(counts[0]);
+        }
+
+        if (m_RangeScanner && m_Config->data().stream > 0){
+            std::vector<RkKernels::Range> ranges(NO_OF_CORES);
+            if (!Consume(input_file_stream, input_file_name, ranges, [this](const RkUtil::PayloadSlice& slice, RkKernels::Range& range){
+                m_RangeScanner(slice.view(), range);
+            })){
+                return false;
+            }
+            for (const RkKernels::Range& range : ranges){
+                m_DataRange.Merge(range);
+            }
+            if (!MakeKernel(m_DataRange)){
+                return false;
+            }
+        }else if (m_RangeScanner){
+            // the range is only known at the end, so wide payloads are held on to and binned after
+            struct Held {
+                RkKernels::Range range;
+                std::vector<RkUtil::PayloadSlice> slices;
+            };
+            std::vector<Held> held(NO_OF_CORES);
+            if (!Consume(input_file_stream, input_file_name, held, [this](RkUtil::PayloadSlice& slice, Held& h){
+                m_RangeScanner(slice.view(), h.range);
+                h.slices.push_back(std::move(slice));
+            })){
+                return false;
+            }
+            for (Held& h : held){
+                m_DataRange.Merge(h.range);
+                std::move(h.slices.begin(), h.slices.end(), std::back_inserter(m_DecompressedData));
+            }
+            if (!MakeKernel(m_DataRange)){
+                return false;
+            }
+            Histogram();
+            return true;
+        }
+
+        std::vector<Tally> tallies;
+        tallies.reserve(NO_OF_CORES);
+        for (std::size_t i = 0; i < NO_OF_CORES; ++i){
+            tallies.emplace_back(m_Bins, RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type]);
+        }
+        const bool ok = Consume(input_file_stream, input_file_name, tallies, [this](const RkUtil::PayloadSlice& slice, Tally& tally){
+            tally.Count(m_Kernel, slice.view());
+        });
+        for (Tally& tally : tallies){
+            std::promise<bins_type> ready;
+            ready.set_value(tally.Total());
+            m_Futures.push_back(ready.get_future());
+        }
+
+        return ok;
+    }
+
+    /*
+     * The encoder pushes fixed size chunks into a bounded queue while it inflates and
+     * NO_OF_CORES workers pull from it, worker i folding every chunk it gets into states[i].
+     * They block on the queue, so they are threads of their own (Consumers()) whatever the
+     * backend: blocked in a TBB arena they could leave the decoder without consumers, blocked on
+     * Pool() they would leave a parallel decoder's loops without workers. A parallel decoder
+     * (indexed, speculative, multi member inflate) and the consumers split the cores between them
+     * instead of each taking all, states past the consumers' share stay untouched.
+     * Within a --stream budget the encoder decodes into a ring of budget / chunk size buffers (at
+     * least STREAM_RING_BUFFERS, chunks shrink for small budgets), a buffer going back to the ring
+     * as soon as its chunk is counted; the decoder waits for one when all are out.
+    */
+    template<typename State, typename Fold>
+    bool Consume(std::ifstream& input_file_stream, const std::string& input_file_name,
+                 std::vector<State>& states, Fold fold){
+
+        const std::size_t jump = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+        const std::size_t budget = m_Config->data().stream << 20;
+        std::size_t chunk_size = budget ? std::min(PIPELINE_CHUNK_SIZE, budget / STREAM_RING_BUFFERS) : PIPELINE_CHUNK_SIZE;
+        chunk_size = std::max(chunk_size - (chunk_size % jump), jump);
+        // declared ahead of the queue: slices left in it give their buffers back on its way out
+        std::unique_ptr<RkUtil::BufferRing> ring;
+        if (budget){
+            ring = std::make_unique<RkUtil::BufferRing>(budget / chunk_size, chunk_size);
+        }
+        RkUtil::BoundedQueue<RkUtil::PayloadSlice> queue(PIPELINE_QUEUE_DEPTH * NO_OF_CORES);
+
+        RkEncoders::DecodeOptions options = DecodeOptions(chunk_size);
+        options.ring = ring.get();
+        // a parallel decoder gets half of the cores for its loops (the calling thread among them),
+        // the consumers the other half
+        std::size_t consumers = states.size();
+        if (m_Encoder->DecodesInParallel(options) && NO_OF_CORES > 1){
+            options.workers = (NO_OF_CORES + 1) / 2;
+            consumers = std::min(consumers, NO_OF_CORES - options.workers);
+        }
+
+        std::vector<std::future<void>> workers;
+        for (std::size_t i = 0; i < consumers; ++i){
+            workers.push_back(Consumers().Submit([&queue, &state = states[i], &fold](){
+                for (RkUtil::PayloadSlice slice; queue.Pop(slice); ){
+                    fold(slice, state);
+                    // not held on to while waiting for the next: its buffer may be all the ring has left
+                    slice = RkUtil::PayloadSlice();
+                }
+            }));
+        }
+
+        const bool ok = m_Encoder->Stream(input_file_stream, input_file_name, options,
+                                          [&queue](RkUtil::PayloadSlice&& slice){
+            return queue.Push(std::move(slice));
+        });
+        queue.Close();
+        // workers must be done with the queue before it goes out of scope
+        for (auto& fu : workers){
+            fu.wait();
+        }
+
+        return ok;
+    }
+
+    RkEncoders::DecodeOptions DecodeOptions(const std::size_t chunk_size) const{
 
-        return 0.0;
+        RkEncoders::DecodeOptions options;
+        options.element_size = RkUtil::PAYLOAD_TYPE_SIZE[(int)m_Type];
+        options.data_size = m_DataSize * options.element_size;
+        options.chunk_size = chunk_size;
+        options.workers = Exec().Concurrency();
+        options.gzip_backend = m_GzipBackend;
+        return options;
     }
 
     static constexpr int MAX_DIMENSIONS = 16;
+    static constexpr std::size_t PIPELINE_CHUNK_SIZE = 1 << 20;
+    static constexpr std::size_t PIPELINE_QUEUE_DEPTH = 4;
+    static constexpr std::size_t STREAM_RING_BUFFERS = 4;
+    static constexpr std::size_t SCHEDULE_CHUNK_SIZE = 256 << 10;
+    static constexpr std::size_t REDUCE_BLOCK_BINS = 2048;
+    static constexpr std::size_t REDUCE_FAN_IN = 16;
+    static constexpr std::size_t RADIX_ROUND_VOXELS = std::size_t(1) << 24;
+    static constexpr std::size_t RADIX_BLOCK_VOXELS = 4096;
 
     RkUtil::PAYLOAD_TYPE m_Type;
-    std::uint16_t m_Bins;
+    RkKernels::Kernel<count_type> m_Kernel;
+    // huge histograms: bins only, for the radix partitioned two pass count
+    RkKernels::Kernel<RkKernels::BinIndex> m_IndexKernel;
+    RkKernels::RadixPlan m_RadixPlan;
+    // auto range: per value counting (8 / 16 bit) or a min / max scan first (wider)
+    RkKernels::Kernel<std::uint64_t> m_DomainKernel;
+    std::size_t m_DomainSize = 0;
+    double m_DomainLowest = 0;
+    RkKernels::RangeScanner m_RangeScanner;
+    RkKernels::Range m_DataRange;
+    bool m_RangeScanned = false;
+    bool m_ByteSwap = false;
+    std::uint32_t m_Bins;
     std::uint8_t m_Dimension;
     std::array<std::size_t, MAX_DIMENSIONS> m_Sizes;
     std::shared_ptr<RkEncoders::IEncoder> m_Encoder;
-    std::vector<std::uint32_t> m_Output;
-    std::vector<std::string> m_DecompressedData;
+    RkEncoders::GzipBackend m_GzipBackend;
+    std::uint64_t m_OutputMax;
+    std::vector<bins_output_type> m_Output;
+    std::vector<RkUtil::PayloadSlice> m_DecompressedData;
     std::deque<std::future<bins_type>> m_Futures;
     std::size_t m_DataSize;
     const std::unique_ptr<RkConfig>& m_Config;
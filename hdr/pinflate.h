@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <functional>
+
+// Index free parallel inflate of gzip data, after pugz / rapidgzip.
+// The compressed bytes are cut into chunks. Every chunk but the first searches its range for
+// something that parses and decodes like a deflate block, then decodes from there on with an
+// unknown 32K window: back references into it are kept as markers in 16 bit symbols. The
+// chunks are chained afterwards, each one only accepted if its predecessor ends exactly where
+// it started, and markers are replaced once the preceding window is known. Chunks that fail
+// the check are decoded again by their predecessor, so the result is always exact.
+namespace RkPInflate {
+
+// Runs body(0) .. body(count - 1), possibly concurrently, and returns when all are done.
+using ParallelFor = std::function<void(std::size_t count, const std::function<void(std::size_t)>& body)>;
+
+struct Result {
+    std::shared_ptr<char[]> data;
+    std::uint64_t size = 0;
+};
+
+// Inflate all gzip members in [in, in + in_len) using chunks of about chunk_size compressed bytes.
+// Returns Z_OK, or a zlib error code if the data is corrupt (including crc / length mismatches).
+int Inflate(const unsigned char* in, std::size_t in_len, std::size_t chunk_size,
+            const ParallelFor& parallel_for, Result& result);
+
+}
@@ -0,0 +1,308 @@
+#include "../hdr/gzindex.h"
+
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <algorithm>
+#include <exception>
+
+namespace RkGzIndex {
+
+namespace {
+
+constexpr char INDEX_MAGIC[8] = {'R', 'K', 'G', 'Z', 'I', 'D', 'X', '1'};
+constexpr std::size_t OUT_CHUNK = 1 << 18;
+// zlib counts input in uInt, so huge payloads are fed in pieces
+constexpr std::size_t MAX_FEED = 1u << 30;
+constexpr std::size_t FINGERPRINT_SPAN = 1 << 16;
+// out, in, bits, window and packed lengths: the least a point takes in the sidecar
+constexpr std::uint64_t POINT_RECORD_SIZE = 8 + 8 + 4 + 4 + 4;
+
+void Feed(z_stream& strm, const unsigned char*& next, std::size_t& left){
+    const std::size_t n = std::min(left, MAX_FEED);
+    strm.next_in = const_cast<Bytef*>(next);
+    strm.avail_in = static_cast<uInt>(n);
+    next += n;
+    left -= n;
+}
+
+// Cheap identity of the compressed payload: its size and the crc of both ends,
+// the tail holding the gzip trailer (crc32 + isize of the decoded data).
+std::uint32_t Fingerprint(const unsigned char* in, std::size_t in_len){
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const std::size_t head = std::min(in_len, FINGERPRINT_SPAN);
+    crc = crc32(crc, in, static_cast<uInt>(head));
+    const std::size_t tail = std::min(in_len - head, FINGERPRINT_SPAN);
+    crc = crc32(crc, in + in_len - tail, static_cast<uInt>(tail));
+    return static_cast<std::uint32_t>(crc);
+}
+
+template<typename T>
+void Put(std::ofstream& os, const T& v){
+    os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+bool Get(std::ifstream& is, T& v){
+    return static_cast<bool>(is.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+bool IsGzipMember(const unsigned char* p, std::size_t left){
+    return left >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == Z_DEFLATED;
+}
+
+}
+
+int BuildIndex(const unsigned char* in, std::size_t in_len, std::uint64_t span,
+               GzIndex& index, const OutputSink& sink){
+
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    // 15 + 16: gzip wrapper, so header and trailer crc are checked on this pass
+    int ret = inflateInit2(&strm, 15 + 16);
+    if (ret != Z_OK){
+        return ret;
+    }
+
+    std::vector<unsigned char> out(OUT_CHUNK);
+    const unsigned char* next = in;
+    std::size_t left = in_len;
+    std::uint64_t totin = 0, totout = 0, last = 0;
+    bool member_start = true;
+
+    index.points.clear();
+    index.total_out = 0;
+
+    strm.next_out = out.data();
+    strm.avail_out = static_cast<uInt>(out.size());
+    for (;;){
+        if (strm.avail_in == 0 && left > 0){
+            Feed(strm, next, left);
+        }
+        if (strm.avail_out == 0){
+            if (!sink(out.data(), out.size())){
+                ret = Z_BUF_ERROR;
+                break;
+            }
+            strm.next_out = out.data();
+            strm.avail_out = static_cast<uInt>(out.size());
+        }
+
+        totin += strm.avail_in;
+        totout += strm.avail_out;
+        ret = inflate(&strm, Z_BLOCK);
+        totin -= strm.avail_in;
+        totout -= strm.avail_out;
+        // no progress with room for output: input ran out mid member
+        if (ret == Z_NEED_DICT || ret == Z_BUF_ERROR){
+            ret = Z_DATA_ERROR;
+        }
+        if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR || ret == Z_STREAM_ERROR){
+            break;
+        }
+
+        if (ret == Z_STREAM_END){
+            // concatenated members (pigz, bgzip...) carry on after the trailer
+            // input is one contiguous mapping, so fed and unfed bytes can be looked at together
+            if (!IsGzipMember(strm.next_in, strm.avail_in + left)){
+                ret = Z_OK;
+                break;
+            }
+            inflateReset(&strm);
+            member_start = true;
+            continue;
+        }
+
+        // at the end of a deflate block header (bit 7) but not of the last block (bit 6)
+        if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                (member_start || totout - last >= span)){
+            AccessPoint point;
+            point.out = totout;
+            point.in = totin;
+            point.bits = strm.data_type & 7;
+            point.window.resize(WINDOW_SIZE);
+            uInt have = 0;
+            inflateGetDictionary(&strm, point.window.data(), &have);
+            point.window.resize(member_start ? 0 : have);
+            index.points.push_back(std::move(point));
+            last = totout;
+            member_start = false;
+        }
+    }
+
+    const std::size_t pending = out.size() - strm.avail_out;
+    if (ret == Z_OK && pending > 0 && !sink(out.data(), pending)){
+        ret = Z_BUF_ERROR;
+    }
+    index.total_out = totout;
+    inflateEnd(&strm);
+
+    return ret;
+}
+
+int InflateRange(const unsigned char* in, std::size_t in_len, const AccessPoint& from,
+                 unsigned char* dst, std::size_t len){
+
+    if (from.in > in_len || (from.bits && from.in == 0)){
+        return Z_DATA_ERROR;
+    }
+
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    int ret = inflateInit2(&strm, -15);
+    if (ret != Z_OK){
+        return ret;
+    }
+
+    const unsigned char* next = in + from.in;
+    std::size_t left = in_len - from.in;
+    if (from.bits){
+        ret = inflatePrime(&strm, from.bits, next[-1] >> (8 - from.bits));
+    }
+    if (ret == Z_OK && !from.window.empty()){
+        ret = inflateSetDictionary(&strm, from.window.data(), static_cast<uInt>(from.window.size()));
+    }
+
+    while (ret == Z_OK && len > 0){
+        if (strm.avail_in == 0){
+            if (left == 0){
+                ret = Z_DATA_ERROR;
+                break;
+            }
+            Feed(strm, next, left);
+        }
+        const std::size_t n = std::min<std::size_t>(len, UINT_MAX);
+        strm.next_out = dst;
+        strm.avail_out = static_cast<uInt>(n);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        const std::size_t produced = n - strm.avail_out;
+        dst += produced;
+        len -= produced;
+        if (ret == Z_STREAM_END){
+            ret = len == 0 ? Z_OK : Z_DATA_ERROR;
+            break;
+        }
+        if (ret == Z_BUF_ERROR && (produced > 0 || left > 0)){
+            ret = Z_OK;
+        }
+    }
+    inflateEnd(&strm);
+
+    return ret;
+}
+
+bool SaveIndex(const std::string& path, const GzIndex& index,
+               const unsigned char* in, std::size_t in_len){
+
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os.is_open()){
+        return false;
+    }
+
+    os.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    Put(os, static_cast<std::uint64_t>(in_len));
+    Put(os, Fingerprint(in, in_len));
+    Put(os, index.total_out);
+    Put(os, static_cast<std::uint64_t>(index.points.size()));
+
+    std::vector<unsigned char> packed(compressBound(WINDOW_SIZE));
+    for (const auto& point : index.points){
+        // windows of image data deflate well, keeps the sidecar small
+        uLongf packed_len = packed.size();
+        if (!point.window.empty() &&
+                compress2(packed.data(), &packed_len, point.window.data(), point.window.size(), 1) != Z_OK){
+            return false;
+        }
+        if (point.window.empty()){
+            packed_len = 0;
+        }
+        Put(os, point.out);
+        Put(os, point.in);
+        Put(os, static_cast<std::int32_t>(point.bits));
+        Put(os, static_cast<std::uint32_t>(point.window.size()));
+        Put(os, static_cast<std::uint32_t>(packed_len));
+        os.write(reinterpret_cast<const char*>(packed.data()), packed_len);
+    }
+
+    return static_cast<bool>(os);
+}
+
+namespace {
+
+// What a sidecar claims is checked against the payload before anything is allocated or inflated
+// by it: a stale or damaged index is rejected, never trusted.
+bool ReadIndex(const std::string& path, const unsigned char* in, std::size_t in_len,
+               std::uint64_t total_out, GzIndex& index){
+
+    std::ifstream is(path, std::ios::binary | std::ios::ate);
+    if (!is.is_open()){
+        return false;
+    }
+    const std::streamoff file_len = is.tellg();
+    is.seekg(0);
+
+    char magic[sizeof(INDEX_MAGIC)];
+    std::uint64_t compressed_size, count;
+    std::uint32_t fingerprint;
+    if (!is.read(magic, sizeof(magic)) || std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) ||
+            !Get(is, compressed_size) || compressed_size != in_len ||
+            !Get(is, fingerprint) || fingerprint != Fingerprint(in, in_len) ||
+            !Get(is, index.total_out) || index.total_out != total_out || !Get(is, count)){
+        return false;
+    }
+    // no more points than the rest of the file has records for
+    if (count > std::uint64_t(std::max<std::streamoff>(file_len - is.tellg(), 0)) / POINT_RECORD_SIZE){
+        return false;
+    }
+
+    std::vector<unsigned char> packed(compressBound(WINDOW_SIZE));
+    index.points.clear();
+    index.points.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i){
+        AccessPoint point;
+        std::int32_t bits;
+        std::uint32_t window_len, packed_len;
+        if (!Get(is, point.out) || !Get(is, point.in) || !Get(is, bits) ||
+                !Get(is, window_len) || !Get(is, packed_len) ||
+                window_len > WINDOW_SIZE || packed_len > packed.size() ||
+                !is.read(reinterpret_cast<char*>(packed.data()), packed_len)){
+            return false;
+        }
+        // ranges run from one point to the next: outputs strictly increasing from 0, inputs in order
+        const bool first = index.points.empty();
+        if ((first ? point.out != 0 : point.out <= index.points.back().out) ||
+                point.out >= index.total_out ||
+                (!first && point.in < index.points.back().in) ||
+                point.in > in_len || bits < 0 || bits > 7 || (bits && point.in == 0)){
+            return false;
+        }
+        point.bits = bits;
+        point.window.resize(window_len);
+        uLongf unpacked_len = window_len;
+        if (window_len && (uncompress(point.window.data(), &unpacked_len, packed.data(), packed_len) != Z_OK ||
+                           unpacked_len != window_len)){
+            return false;
+        }
+        index.points.push_back(std::move(point));
+    }
+
+    return !index.points.empty();
+}
+
+}
+
+bool LoadIndex(const std::string& path, const unsigned char* in, std::size_t in_len,
+               std::uint64_t total_out, GzIndex& index){
+
+    try{
+        if (ReadIndex(path, in, in_len, total_out, index)){
+            return true;
+        }
+    }catch(std::exception&){
+        // a count no allocation satisfies, the caller rebuilds
+    }
+    index.points.clear();
+    return false;
+}
+
+}
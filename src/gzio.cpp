@@ -5,6 +5,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <cerrno>
+#include <climits>
 
 /* default memLevel */
 #if MAX_MEM_LEVEL >= 8
@@ -16,6 +17,11 @@
 /* stream buffer size */
 #define Z_BUFSIZE 16 * 1024
 
+/* smallest member: 10 byte header, empty deflate block, 8 byte trailer */
+#define GZ_MIN_MEMBER 20
+/* deflate expands at most 1032:1 (258 bytes per 2 bit match) */
+#define GZ_MAX_RATIO 1032
+
 /* gzip flag byte */
 #define ASCII_FLAG   0x01 /* bit 0 set: file probably ascii text */
 #define HEAD_CRC     0x02 /* bit 1 set: header CRC present */
@@ -36,30 +42,22 @@ typedef struct _NrrdGzStream {
   int      transparent; /* 1 if input file is not a .gz file */
   char     mode;    /* 'w' or 'r' */
   long     startpos; /* start of compressed data in file (header skipped) */
+  const Byte *mem;  /* compressed bytes when reading from memory, else NULL */
+  size_t   mem_left; /* bytes of mem not yet handed to inflate */
 } _NrrdGzStream;
 
 static int _nrrdGzMagic[2] = {0x1f, 0x8b}; /* gzip magic header */
 
-/* zlib error messages */
-static const char *_nrrdGzErrMsg[10] = {
-  "need dictionary",     /* Z_NEED_DICT       2  */
-  "stream end",          /* Z_STREAM_END      1  */
-  "",                    /* Z_OK              0  */
-  "file error",          /* Z_ERRNO         (-1) */
-  "stream error",        /* Z_STREAM_ERROR  (-2) */
-  "data error",          /* Z_DATA_ERROR    (-3) */
-  "insufficient memory", /* Z_MEM_ERROR     (-4) */
-  "buffer error",        /* Z_BUF_ERROR     (-5) */
-  "incompatible version",/* Z_VERSION_ERROR (-6) */
-  ""
-};
-
 /* some forward declarations for things in this file */
 static void GzCheckHeader(_NrrdGzStream *s);
 static int GzDestroy(_NrrdGzStream *s);
 static int GzDoFlush(gzFile file, int flush);
 static void GzPutLong(FILE *file, uLong x);
 static uLong GzGetLong(_NrrdGzStream *s);
+static uInt GzFillInput(_NrrdGzStream *s);
+static int GzIsHeader(const Byte *p, size_t left);
+static size_t GzBgzfBlockSize(const Byte *p, size_t left);
+static int GzReadSome(gzFile file, void* buf, uInt len, uInt* didread);
 
 void* SafeFree(void *ptr) {
 
@@ -70,7 +68,6 @@ void* SafeFree(void *ptr) {
 }
 
 gzFile GzOpen(FILE* fd, const char* mode) {
-  static const char me[]="GzOpen";
   int error;
   int level = Z_DEFAULT_COMPRESSION; /* compression level */
   int strategy = Z_DEFAULT_STRATEGY; /* compression strategy */
@@ -155,8 +152,112 @@ gzFile GzOpen(FILE* fd, const char* mode) {
   return (gzFile)s;
 }
 
+gzFile GzOpenMem(const void* data, size_t len) {
+  _NrrdGzStream *s;
+
+  if (!data) {
+    return Z_NULL;
+  }
+  s = (_NrrdGzStream *)calloc(1, sizeof(_NrrdGzStream));
+  if (!s) {
+    return Z_NULL;
+  }
+  /* inflate reads straight out of the caller's buffer (typically a file
+   * mapping), so no input buffer is allocated and nothing is copied */
+  s->stream.zalloc = (alloc_func)0;
+  s->stream.zfree = (free_func)0;
+  s->stream.opaque = (voidpf)0;
+  s->stream.next_in = s->inbuf = Z_NULL;
+  s->stream.next_out = s->outbuf = Z_NULL;
+  s->stream.avail_in = s->stream.avail_out = 0;
+  s->file = NULL;
+  s->mem = (const Byte*)data;
+  s->mem_left = len;
+  s->z_err = Z_OK;
+  s->z_eof = 0;
+  s->crc = crc32(0L, Z_NULL, 0);
+  s->msg = NULL;
+  s->transparent = 0;
+  s->mode = 'r';
+  if (inflateInit2(&(s->stream), -MAX_WBITS) != Z_OK) {
+    return GzDestroy(s), (gzFile)Z_NULL;
+  }
+  GzCheckHeader(s); /* skip the .gz header */
+  s->startpos = 0;
+
+  return (gzFile)s;
+}
+
+int GzListMembers(const void* data, size_t len, std::vector<GzMember>& members) {
+  const Byte *p = (const Byte*)data;
+  size_t at = 0, out = 0, next, bsize;
+  const Byte *c;
+  GzMember m;
+
+  members.clear();
+  while (at < len) {
+    if (!GzIsHeader(p + at, len - at)) {
+      return Z_DATA_ERROR;
+    }
+    next = len;
+    if ((bsize = GzBgzfBlockSize(p + at, len - at)) != 0) {
+      next = at + bsize;
+    } else {
+      /* next header after the shortest possible member */
+      for (c = p + at + GZ_MIN_MEMBER; c < p + len; c++) {
+        c = (const Byte*)memchr(c, _nrrdGzMagic[0], (size_t)(p + len - c));
+        if (!c) break;
+        if (GzIsHeader(c, (size_t)(p + len - c))) {
+          next = (size_t)(c - p);
+          break;
+        }
+      }
+    }
+    if (next > len || next - at < GZ_MIN_MEMBER) {
+      return Z_DATA_ERROR;
+    }
+    /* ISIZE, the last 4 bytes of the trailer */
+    m.in = at;
+    m.len = next - at;
+    m.out = out;
+    m.size = (size_t)p[next - 4] | (size_t)p[next - 3] << 8 |
+             (size_t)p[next - 2] << 16 | (size_t)p[next - 1] << 24;
+    if (m.size / GZ_MAX_RATIO > m.len) {
+      return Z_DATA_ERROR; /* not a trailer, the split was wrong */
+    }
+    out += m.size;
+    members.push_back(m);
+    at = next;
+  }
+  return members.empty() ? Z_DATA_ERROR : Z_OK;
+}
+
+int GzInflateMember(const void* data, const GzMember* member, void* dst) {
+  _NrrdGzStream *s;
+  size_t didread, more;
+  Byte extra;
+  int error = Z_OK;
+
+  s = (_NrrdGzStream*)GzOpenMem((const Byte*)data + member->in, member->len);
+  if (s == NULL) {
+    return Z_MEM_ERROR;
+  }
+  if (s->transparent || s->z_err != Z_OK) {
+    error = Z_DATA_ERROR;
+  } else if (GzRead((gzFile)s, dst, member->size, &didread) ||
+             didread != member->size) {
+    error = Z_DATA_ERROR;
+  /* one more read runs into the trailer: crc checked, nothing may follow */
+  } else if (GzRead((gzFile)s, &extra, 1, &more) || more != 0 ||
+             s->z_err != Z_STREAM_END) {
+    error = Z_DATA_ERROR;
+  }
+  GzClose((gzFile)s);
+
+  return error;
+}
+
 int GzClose (gzFile file) {
-  static const char me[]="GzClose";
   int error;
   _NrrdGzStream *s = (_NrrdGzStream*)file;
 
@@ -174,8 +275,38 @@ int GzClose (gzFile file) {
   return GzDestroy((_NrrdGzStream*)file);
 }
 
-int GzRead(gzFile file, void* buf, unsigned int len, unsigned int* didread) {
-  static const char me[]="GzRead";
+const void* GzInputPosition(gzFile file) {
+  _NrrdGzStream *s = (_NrrdGzStream*)file;
+
+  if (s == NULL || !s->mem) {
+    return NULL;
+  }
+  /* the unread rest of the window handed to inflate ends where mem starts */
+  return s->stream.avail_in ? (const void*)s->stream.next_in : (const void*)s->mem;
+}
+
+/* zlib counts output in uInt, reads past 4GB go in pieces */
+int GzRead(gzFile file, void* buf, size_t len, size_t* didread) {
+  Byte *out = (Byte*)buf;
+  uInt n, got;
+
+  *didread = 0;
+  while (len > 0) {
+    n = len < (size_t)UINT_MAX ? (uInt)len : UINT_MAX;
+    if (GzReadSome(file, out, n, &got)) {
+      return 1;
+    }
+    out += got;
+    *didread += got;
+    len -= got;
+    if (got < n) {
+      break;
+    }
+  }
+  return 0;
+}
+
+static int GzReadSome(gzFile file, void* buf, uInt len, uInt* didread) {
   _NrrdGzStream *s = (_NrrdGzStream*)file;
   Bytef *start = (Bytef*)buf; /* starting point for crc computation */
   Byte  *next_out; /* == stream.next_out but not forced far (for MSDOS) */
@@ -214,8 +345,16 @@ int GzRead(gzFile file, void* buf, unsigned int len, unsigned int* didread) {
         s->stream.avail_in  -= n;
       }
       if (s->stream.avail_out > 0) {
-        s->stream.avail_out -= (uInt)fread(next_out, 1, s->stream.avail_out,
-                                           s->file);
+        if (s->mem) {
+          n = s->mem_left < s->stream.avail_out ? (uInt)s->mem_left : s->stream.avail_out;
+          memcpy(next_out, s->mem, n);
+          s->mem += n;
+          s->mem_left -= n;
+          s->stream.avail_out -= n;
+        } else {
+          s->stream.avail_out -= (uInt)fread(next_out, 1, s->stream.avail_out,
+                                             s->file);
+        }
       }
       len -= s->stream.avail_out;
       s->stream.total_in  += len;
@@ -226,15 +365,13 @@ int GzRead(gzFile file, void* buf, unsigned int len, unsigned int* didread) {
     }
     if (s->stream.avail_in == 0 && !s->z_eof) {
 
-      s->stream.avail_in = (uInt)fread(s->inbuf, 1, Z_BUFSIZE, s->file);
-      if (s->stream.avail_in == 0) {
+      if (GzFillInput(s) == 0) {
         s->z_eof = 1;
-        if (ferror(s->file)) {
+        if (s->file && ferror(s->file)) {
           s->z_err = Z_ERRNO;
           break;
         }
       }
-      s->stream.next_in = s->inbuf;
     }
     s->z_err = inflate(&(s->stream), Z_NO_FLUSH);
 
@@ -272,26 +409,61 @@ int GzRead(gzFile file, void* buf, unsigned int len, unsigned int* didread) {
 }
 
 static int GzGetByte(_NrrdGzStream *s) {
-  static const char me[]="GzGetByte";
 
   if (s->z_eof) return EOF;
   if (s->stream.avail_in == 0) {
-    s->stream.avail_in = (uInt)fread(s->inbuf, 1, Z_BUFSIZE, s->file);
-    if (s->stream.avail_in == 0) {
+    if (GzFillInput(s) == 0) {
       s->z_eof = 1;
-      if (ferror(s->file)) {
+      if (s->file && ferror(s->file)) {
         s->z_err = Z_ERRNO;
       }
       return EOF;
     }
-    s->stream.next_in = s->inbuf;
   }
   s->stream.avail_in--;
   return *(s->stream.next_in)++;
 }
 
+/* Refill the inflate input from the file, or point it at the next window of
+ * the in-memory source. Returns the number of bytes made available. */
+static uInt GzFillInput(_NrrdGzStream *s) {
+  if (s->mem) {
+    uInt n = s->mem_left < (size_t)UINT_MAX ? (uInt)s->mem_left : UINT_MAX;
+    s->stream.next_in = (Bytef*)s->mem;
+    s->stream.avail_in = n;
+    s->mem += n;
+    s->mem_left -= n;
+    return n;
+  }
+  s->stream.avail_in = (uInt)fread(s->inbuf, 1, Z_BUFSIZE, s->file);
+  s->stream.next_in = s->inbuf;
+  return s->stream.avail_in;
+}
+
+/* magic, deflate and sane flag / extra flag bytes: plausible member start */
+static int GzIsHeader(const Byte *p, size_t left) {
+  return left >= GZ_MIN_MEMBER && p[0] == _nrrdGzMagic[0] && p[1] == _nrrdGzMagic[1] &&
+         p[2] == Z_DEFLATED && (p[3] & RESERVED) == 0 &&
+         (p[8] == 0 || p[8] == 2 || p[8] == 4);
+}
+
+/* total size of a BGZF block, from the BSIZE of its "BC" extra subfield, or 0 */
+static size_t GzBgzfBlockSize(const Byte *p, size_t left) {
+  size_t xlen, at, slen;
+
+  if (!(p[3] & EXTRA_FIELD) || left < 12) return 0;
+  xlen = (size_t)p[10] | (size_t)p[11] << 8;
+  if (12 + xlen > left) return 0;
+  for (at = 12; at + 4 <= 12 + xlen; at += 4 + slen) {
+    slen = (size_t)p[at + 2] | (size_t)p[at + 3] << 8;
+    if (p[at] == 'B' && p[at + 1] == 'C' && slen == 2 && at + 6 <= 12 + xlen) {
+      return ((size_t)p[at + 4] | (size_t)p[at + 5] << 8) + 1;
+    }
+  }
+  return 0;
+}
+
 static void GzCheckHeader(_NrrdGzStream *s) {
-  static const char me[]="GzCheckHeader";
   int method; /* method byte */
   int flags;  /* flags byte */
   uInt len;
@@ -339,7 +511,6 @@ static void GzCheckHeader(_NrrdGzStream *s) {
 }
 
 static int GzDestroy(_NrrdGzStream *s) {
-  static const char me[]="GzDestroy";
   int error = Z_OK;
 
   if (s == NULL) {
@@ -365,7 +536,6 @@ static int GzDestroy(_NrrdGzStream *s) {
 }
 
 static int GzDoFlush(gzFile file, int flush) {
-  static const char me[]="GzDoFlush";
   uInt len;
   int done = 0;
   _NrrdGzStream *s = (_NrrdGzStream*)file;
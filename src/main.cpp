@@ -1,19 +1,25 @@
 #include "../hdr/histogram.h"
 #include "../hdr/config.h"
 
-std::size_t const Task::NO_OF_CORES = std::thread::hardware_concurrency();
+std::size_t Task::NO_OF_CORES = RkUtil::Affinity::UsableCpus();
 
 #ifndef RUN_CATCH
 int main(int argc, char *argv[])
 {
     std::unique_ptr<RkConfig> config = std::make_unique<RkConfig>([](config_data &d, boost::program_options::options_description &desc){
         desc.add_options()
-                ("bins, b", boost::program_options::value<std::uint16_t>(&d.bins)->default_value(300), "# of bins in histogram (int)")
-                ("min, min", boost::program_options::value<double>(&d.min)->default_value(0.0), "Value at low end of histogram. Defaults to lowest value found in input nrrd. (double)")
-                ("max, max", boost::program_options::value<double>(&d.max)->default_value(300.0), "Value at high end of histogram. Defaults to highest value found in input nrrd. (double)")
-                ("type, t", boost::program_options::value<uint8_t>(&d.type)->default_value(1), "type to use for bins in output histogram; default: \"uint\"")
+                ("bins, b", boost::program_options::value<std::uint32_t>(&d.bins)->default_value(300), "# of bins in histogram (int)")
+                ("min, min", boost::program_options::value<double>(&d.min)->default_value(std::numeric_limits<double>::quiet_NaN(), "auto"), "Value at low end of histogram. Defaults to lowest value found in input nrrd. (double)")
+                ("max, max", boost::program_options::value<double>(&d.max)->default_value(std::numeric_limits<double>::quiet_NaN(), "auto"), "Value at high end of histogram. Defaults to highest value found in input nrrd. (double)")
+                ("type,t", boost::program_options::value<std::string>(&d.type)->default_value("uint"), "type to use for bins in output histogram: uchar | uint | ulonglong (or uint8 | uint32 | uint64), counts saturate at its max; default: \"uint\"")
                 ("input, i", boost::program_options::value<std::string>(&d.input_file_name)->default_value("../res/sample.nrrd"), "input nrrd")
-                ("output, o", boost::program_options::value<std::string>(&d.output_file_name)->default_value("../solution.txt"), "solution file");
+                ("output, o", boost::program_options::value<std::string>(&d.output_file_name)->default_value("../solution.txt"), "solution file")
+                ("pipeline", boost::program_options::bool_switch(&d.pipeline)->default_value(false), "overlap decoding and histogramming through a bounded queue of decoded chunks")
+                ("stream", boost::program_options::value<std::size_t>(&d.stream)->default_value(0), "bounded memory streaming (implies --pipeline): decode through a ring of buffers of at most this many MiB, peak memory independent of the volume size; 0: off")
+                ("gzip", boost::program_options::value<std::string>(&d.gzip)->default_value(RkEncoders::DEFAULT_GZIP_BACKEND), "gzip inflate backend: boost | gzio | indexed (parallel, keeps <input>.gzidx next to the input) | speculative (parallel, no index)")
+                ("kernel", boost::program_options::value<std::string>(&d.kernel)->default_value("auto"), "hot loop variant: auto (best the CPU has) | scalar | avx2 | avx512")
+                ("pin", boost::program_options::value<std::string>(&d.pin)->default_value("none"), "worker pinning: none | compact (hyperthread siblings together) | scatter (every core before any sibling) | physical (one worker per physical core)")
+                ("backend", boost::program_options::value<std::string>(&d.backend)->default_value("pool"), "where the parallel loops run: pool (own workers) | tbb (the TBB arena of the caller) | openmp (an OpenMP team, builds with -DWITH_OPENMP=ON)");
     });
 
     try {
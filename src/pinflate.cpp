@@ -0,0 +1,767 @@
+#include "../hdr/pinflate.h"
+
+#include <zlib.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace RkPInflate {
+
+namespace {
+
+constexpr std::size_t WINDOW_SIZE = 32768;
+constexpr int MAX_CODE_BITS = 15;
+constexpr std::size_t MAX_MATCH = 258;
+constexpr std::size_t CRC_PIECE = 1 << 22;
+constexpr std::uint64_t NO_STOP = std::numeric_limits<std::uint64_t>::max();
+// status of a chunk whose range holds no block start we could verify
+constexpr int NOT_FOUND = 1;
+
+const std::uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const std::uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const std::uint16_t DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const std::uint8_t DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const std::uint8_t CLEN_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// LSB first bit reader over the whole compressed payload. Positions are absolute bit offsets
+// so chunks can be compared against each other. Reads past the end yield zero bits.
+class BitReader {
+public:
+    BitReader(const unsigned char* data, std::size_t size)
+        : m_Data(data), m_Size(size), m_Bits(static_cast<std::uint64_t>(size) * 8) {}
+
+    // at least 57 valid bits (little endian host)
+    std::uint64_t Peek() const {
+        const std::size_t byte = m_Pos >> 3;
+        std::uint64_t v = 0;
+        if (byte + 8 <= m_Size){
+            std::memcpy(&v, m_Data + byte, 8);
+        }else{
+            for (std::size_t i = 0; i < 8 && byte + i < m_Size; ++i){
+                v |= static_cast<std::uint64_t>(m_Data[byte + i]) << (8 * i);
+            }
+        }
+        return v >> (m_Pos & 7);
+    }
+
+    std::uint32_t Read(int n){
+        const std::uint32_t v = static_cast<std::uint32_t>(Peek() & ((1ull << n) - 1));
+        m_Pos += n;
+        return v;
+    }
+
+    void Skip(int n) { m_Pos += n; }
+    void AlignToByte() { m_Pos = (m_Pos + 7) & ~7ull; }
+    void Seek(std::uint64_t pos) { m_Pos = pos; }
+    std::uint64_t Position() const { return m_Pos; }
+    bool Overrun() const { return m_Pos > m_Bits; }
+    std::uint64_t Size() const { return m_Bits; }
+    const unsigned char* Bytes() const { return m_Data; }
+
+private:
+    const unsigned char* m_Data;
+    std::size_t m_Size;
+    std::uint64_t m_Bits;
+    std::uint64_t m_Pos = 0;
+};
+
+// Single level canonical Huffman decode table indexed by the next max_bits (bit reversed) input bits.
+class Huffman {
+public:
+    // Same acceptance rules as zlib's inflate_table(): never over-subscribed, and incomplete
+    // only for a lone code of length one (or no codes at all for distances).
+    bool Build(const std::uint8_t* lengths, int count, bool allow_empty){
+
+        int bl_count[MAX_CODE_BITS + 1] = {0};
+        for (int i = 0; i < count; ++i){
+            bl_count[lengths[i]]++;
+        }
+        bl_count[0] = 0;
+        m_MaxBits = 0;
+        for (int b = MAX_CODE_BITS; b > 0; --b){
+            if (bl_count[b]){
+                m_MaxBits = b;
+                break;
+            }
+        }
+        m_Table.assign(std::size_t(1) << m_MaxBits, 0);
+        if (m_MaxBits == 0){
+            return allow_empty;
+        }
+
+        int left = 1;
+        for (int b = 1; b <= MAX_CODE_BITS; ++b){
+            left <<= 1;
+            left -= bl_count[b];
+            if (left < 0){
+                return false;
+            }
+        }
+        if (left > 0 && m_MaxBits != 1){
+            return false;
+        }
+        m_Complete = left == 0;
+
+        int next_code[MAX_CODE_BITS + 2] = {0};
+        for (int b = 1, code = 0; b <= MAX_CODE_BITS; ++b){
+            code = (code + bl_count[b - 1]) << 1;
+            next_code[b] = code;
+        }
+        for (int sym = 0; sym < count; ++sym){
+            const int len = lengths[sym];
+            if (!len){
+                continue;
+            }
+            int code = next_code[len]++, rev = 0;
+            for (int i = 0; i < len; ++i, code >>= 1){
+                rev = (rev << 1) | (code & 1);
+            }
+            const std::uint16_t entry = static_cast<std::uint16_t>((sym << 4) | len);
+            for (std::size_t k = rev; k < m_Table.size(); k += std::size_t(1) << len){
+                m_Table[k] = entry;
+            }
+        }
+        return true;
+    }
+
+    // symbol, or -1 for an unused code
+    bool Complete() const { return m_Complete; }
+
+    int Decode(BitReader& br) const {
+        const std::uint16_t e = m_Table[br.Peek() & (m_Table.size() - 1)];
+        if (!(e & 15)){
+            return -1;
+        }
+        br.Skip(e & 15);
+        return e >> 4;
+    }
+
+private:
+    std::vector<std::uint16_t> m_Table;
+    int m_MaxBits = 0;
+    bool m_Complete = false;
+};
+
+// Growable array without the zero fill of std::vector::resize.
+template<typename T>
+class Buffer {
+public:
+    T* data() { return m_Data.get(); }
+    const T* data() const { return m_Data.get(); }
+    std::size_t size() const { return m_Size; }
+    std::size_t capacity() const { return m_Capacity; }
+    void resize(std::size_t n) { reserve(n); m_Size = n; }
+
+    void reserve(std::size_t n){
+        if (n <= m_Capacity){
+            return;
+        }
+        const std::size_t capacity = std::max(n, m_Capacity * 2);
+        std::unique_ptr<T[]> grown(new T[capacity]);
+        if (m_Size){
+            std::memcpy(grown.get(), m_Data.get(), m_Size * sizeof(T));
+        }
+        m_Data = std::move(grown);
+        m_Capacity = capacity;
+    }
+
+    void clear() { m_Size = 0; }
+
+private:
+    std::unique_ptr<T[]> m_Data;
+    std::size_t m_Size = 0;
+    std::size_t m_Capacity = 0;
+};
+
+struct MemberEnd {
+    std::uint64_t out;   // chunk local output offset of the member's end
+    std::uint32_t crc;
+    std::uint32_t isize;
+};
+
+/*
+ * Decodes one chunk. Output is seg16 followed by seg8:
+ *  - seg16: 16 bit symbols, 0..255 literal bytes, 256 + i byte i of the unknown 32K window in
+ *    front of the chunk. Only used by chunks that did not start at a known position.
+ *  - seg8: plain bytes. Decoding switches to it as soon as the last 32K of output hold no marker
+ *    (or at a member start), seg8 then begins with those 32K as history (m_Prefix).
+*/
+class ChunkDecoder {
+public:
+    ChunkDecoder(const unsigned char* in, std::size_t in_len, bool known_start)
+        : m_Br(in, in_len),
+          m_Markers(!known_start),
+          m_AtMemberHeader(known_start) {}
+
+    // Look for the first verifiable block start in [from, to). On success the first block is
+    // already decoded and the decoder is positioned after it.
+    bool FindStart(std::uint64_t from, std::uint64_t to){
+
+        for (std::uint64_t p = from; p < to && p < m_Br.Size(); ++p){
+            m_Br.Seek(p);
+            const std::uint64_t v = m_Br.Peek();
+            const bool dynamic = (v & 7) == 4 && ((v >> 3) & 31) <= 29 && ((v >> 8) & 31) <= 29;
+            // stored: also insist on zero padding up to the byte boundary
+            const int pad = static_cast<int>((8 - ((p + 3) & 7)) & 7);
+            const bool stored = (v & 7) == 0 && ((v >> 3) & ((1u << pad) - 1)) == 0;
+            if (!dynamic && !stored){
+                continue;
+            }
+            Reset();
+            m_Start = p;
+            bool last = false;
+            if (DecodeBlock(last) == Z_OK && !last && NextHeaderPlausible()){
+                m_End = m_Br.Position();
+                SwitchIfMarkerFree();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Decode whole blocks until standing on a block boundary >= stop, or the end of the data.
+    int DecodeUntil(std::uint64_t stop){
+
+        while (!m_Finished){
+            if (m_AtMemberHeader){
+                m_AtMemberHeader = false;
+                m_Br.AlignToByte();
+                const std::uint64_t header = m_Br.Position();
+                if (!ReadMemberHeader()){
+                    // only the end of the input (zero padding aside) ends the stream, anything
+                    // else is a damaged or cut member
+                    m_Br.Seek(header);
+                    if (!OnlyPaddingLeft()){
+                        return Z_DATA_ERROR;
+                    }
+                    m_Finished = true;
+                    break;
+                }
+                StartMember();
+            }
+            m_End = m_Br.Position();
+            if (m_End >= stop){
+                return Z_OK;
+            }
+
+            bool last = false;
+            const int ret = DecodeBlock(last);
+            if (ret != Z_OK){
+                return ret;
+            }
+            SwitchIfMarkerFree();
+
+            if (last){
+                m_Br.AlignToByte();
+                MemberEnd member;
+                member.out = OutputSize();
+                member.crc = m_Br.Read(16);
+                member.crc |= m_Br.Read(16) << 16;
+                member.isize = m_Br.Read(16);
+                member.isize |= m_Br.Read(16) << 16;
+                if (m_Br.Overrun()){
+                    return Z_DATA_ERROR;
+                }
+                m_Members.push_back(member);
+                m_AtMemberHeader = true;
+                m_End = m_Br.Position();
+            }
+        }
+        m_End = m_Br.Position();
+        return Z_OK;
+    }
+
+    std::uint64_t Start() const { return m_Start; }
+    std::uint64_t End() const { return m_End; }
+    bool Finished() const { return m_Finished; }
+    const std::vector<MemberEnd>& Members() const { return m_Members; }
+
+    std::uint64_t OutputSize() const { return m_Seg16.size() + m_Seg8.size() - m_Prefix; }
+    std::size_t MarkerSymbols() const { return m_Seg16.size(); }
+    const std::uint16_t* Symbols() const { return m_Seg16.data(); }
+    const unsigned char* Bytes() const { return m_Seg8.data() + m_Prefix; }
+    std::size_t ByteCount() const { return m_Seg8.size() - m_Prefix; }
+
+private:
+    void Reset(){
+        m_Seg16.clear();
+        m_Seg8.clear();
+        m_Prefix = m_Floor = 0;
+        m_MarkerFreeFrom = 0;
+        m_Markers = true;
+        m_Members.clear();
+    }
+
+    bool ReadMemberHeader(){
+
+        m_Br.AlignToByte();
+        if (m_Br.Position() + 18 * 8 > m_Br.Size()){
+            return false;
+        }
+        if (m_Br.Read(8) != 0x1f || m_Br.Read(8) != 0x8b || m_Br.Read(8) != Z_DEFLATED){
+            return false;
+        }
+        const std::uint32_t flags = m_Br.Read(8);
+        m_Br.Skip(6 * 8); // mtime, xfl, os
+        if (flags & 0x04){ // FEXTRA
+            const std::uint32_t xlen = m_Br.Read(16);
+            m_Br.Skip(static_cast<int>(xlen) * 8);
+        }
+        for (std::uint32_t mask : {0x08u, 0x10u}){ // FNAME, FCOMMENT
+            if (flags & mask){
+                while (!m_Br.Overrun() && m_Br.Read(8) != 0){}
+            }
+        }
+        if (flags & 0x02){ // FHCRC
+            m_Br.Skip(16);
+        }
+        return !m_Br.Overrun() && !(flags & 0xE0);
+    }
+
+    bool OnlyPaddingLeft(){
+
+        while (m_Br.Position() < m_Br.Size()){
+            if (m_Br.Read(8) != 0){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // History of a new member is empty, so markers can no longer appear.
+    void StartMember(){
+
+        if (m_Markers){
+            m_Markers = false;
+            m_Prefix = 0;
+        }
+        m_Floor = m_Seg8.size();
+    }
+
+    void SwitchIfMarkerFree(){
+
+        if (!m_Markers || m_Seg16.size() - m_MarkerFreeFrom < WINDOW_SIZE){
+            return;
+        }
+        m_Markers = false;
+        m_Seg8.resize(WINDOW_SIZE);
+        const std::uint16_t* tail = m_Seg16.data() + m_Seg16.size() - WINDOW_SIZE;
+        for (std::size_t i = 0; i < WINDOW_SIZE; ++i){
+            m_Seg8.data()[i] = static_cast<unsigned char>(tail[i]);
+        }
+        m_Prefix = WINDOW_SIZE;
+        m_Floor = 0;
+    }
+
+    bool NextHeaderPlausible(){
+
+        const std::uint64_t pos = m_Br.Position();
+        const std::uint64_t v = m_Br.Peek();
+        bool ok = true;
+        switch ((v >> 1) & 3) {
+        case 0: {
+            m_Br.Skip(3);
+            m_Br.AlignToByte();
+            const std::uint32_t len = m_Br.Read(16);
+            ok = (len ^ 0xffff) == m_Br.Read(16);
+            break;
+        }
+        case 2: {
+            Huffman lit, dist;
+            m_Br.Skip(3);
+            ok = ReadDynamicTables(lit, dist);
+            break;
+        }
+        case 3:
+            ok = false;
+            break;
+        default:
+            break;
+        }
+        m_Br.Seek(pos);
+        return ok;
+    }
+
+    bool ReadDynamicTables(Huffman& lit, Huffman& dist){
+
+        const int hlit = static_cast<int>(m_Br.Read(5)) + 257;
+        const int hdist = static_cast<int>(m_Br.Read(5)) + 1;
+        const int hclen = static_cast<int>(m_Br.Read(4)) + 4;
+        if (hlit > 286 || hdist > 30){
+            return false;
+        }
+
+        std::uint8_t clen[19] = {0};
+        for (int i = 0; i < hclen; ++i){
+            clen[CLEN_ORDER[i]] = static_cast<std::uint8_t>(m_Br.Read(3));
+        }
+        Huffman clen_code;
+        if (!clen_code.Build(clen, 19, false) || !clen_code.Complete()){
+            return false;
+        }
+
+        std::uint8_t lengths[286 + 30] = {0};
+        for (int n = 0; n < hlit + hdist; ){
+            const int sym = clen_code.Decode(m_Br);
+            if (sym < 0){
+                return false;
+            }
+            if (sym < 16){
+                lengths[n++] = static_cast<std::uint8_t>(sym);
+                continue;
+            }
+            int repeat;
+            std::uint8_t value = 0;
+            if (sym == 16){
+                if (n == 0){
+                    return false;
+                }
+                value = lengths[n - 1];
+                repeat = 3 + static_cast<int>(m_Br.Read(2));
+            }else if (sym == 17){
+                repeat = 3 + static_cast<int>(m_Br.Read(3));
+            }else{
+                repeat = 11 + static_cast<int>(m_Br.Read(7));
+            }
+            if (n + repeat > hlit + hdist){
+                return false;
+            }
+            while (repeat--){
+                lengths[n++] = value;
+            }
+        }
+        if (m_Br.Overrun() || lengths[256] == 0){
+            return false;
+        }
+
+        return lit.Build(lengths, hlit, false) && dist.Build(lengths + hlit, hdist, true);
+    }
+
+    int DecodeBlock(bool& last){
+
+        last = m_Br.Read(1);
+        const std::uint32_t type = m_Br.Read(2);
+        switch (type) {
+        case 0:
+            return DecodeStored();
+        case 1: {
+            static const std::pair<Huffman, Huffman> fixed = FixedTables();
+            return m_Markers ? DecodeHuffman<true>(fixed.first, fixed.second)
+                             : DecodeHuffman<false>(fixed.first, fixed.second);
+        }
+        case 2: {
+            if (!ReadDynamicTables(m_Lit, m_Dist)){
+                return Z_DATA_ERROR;
+            }
+            return m_Markers ? DecodeHuffman<true>(m_Lit, m_Dist)
+                             : DecodeHuffman<false>(m_Lit, m_Dist);
+        }
+        default:
+            return Z_DATA_ERROR;
+        }
+    }
+
+    static std::pair<Huffman, Huffman> FixedTables(){
+
+        std::uint8_t lengths[288];
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        // 30 and 31 take code space but are invalid, decoding them fails later
+        std::uint8_t dist[32];
+        std::fill(dist, dist + 32, 5);
+        std::pair<Huffman, Huffman> tables;
+        tables.first.Build(lengths, 288, false);
+        tables.second.Build(dist, 32, true);
+        return tables;
+    }
+
+    int DecodeStored(){
+
+        m_Br.AlignToByte();
+        const std::uint32_t len = m_Br.Read(16);
+        if ((len ^ 0xffff) != m_Br.Read(16) || m_Br.Position() + len * 8ull > m_Br.Size()){
+            return Z_DATA_ERROR;
+        }
+        const unsigned char* src = m_Br.Bytes() + (m_Br.Position() >> 3);
+        if (m_Markers){
+            const std::size_t pos = m_Seg16.size();
+            m_Seg16.resize(pos + len);
+            std::copy(src, src + len, m_Seg16.data() + pos);
+        }else{
+            const std::size_t pos = m_Seg8.size();
+            m_Seg8.resize(pos + len);
+            std::memcpy(m_Seg8.data() + pos, src, len);
+        }
+        m_Br.Skip(static_cast<int>(len) * 8);
+        return Z_OK;
+    }
+
+    template<bool MARKERS>
+    int DecodeHuffman(const Huffman& lit, const Huffman& dist){
+
+        using symbol_t = std::conditional_t<MARKERS, std::uint16_t, unsigned char>;
+        auto& seg = [this]() -> auto& {
+            if constexpr (MARKERS) { return m_Seg16; } else { return m_Seg8; }
+        }();
+
+        // symbols are written past size() up to capacity() and committed at the end
+        std::size_t pos = seg.size();
+        seg.reserve(pos + WINDOW_SIZE);
+        symbol_t* out = seg.data();
+        std::size_t capacity = seg.capacity();
+        for (;;){
+            if (pos + MAX_MATCH > capacity){
+                seg.resize(pos);
+                seg.reserve(pos * 2);
+                out = seg.data();
+                capacity = seg.capacity();
+            }
+            const int sym = lit.Decode(m_Br);
+            if (sym < 0 || m_Br.Overrun()){
+                seg.resize(pos);
+                return Z_DATA_ERROR;
+            }
+            if (sym < 256){
+                out[pos++] = static_cast<symbol_t>(sym);
+                continue;
+            }
+            if (sym == 256){
+                break;
+            }
+            const int ls = sym - 257;
+            if (ls >= 29){
+                seg.resize(pos);
+                return Z_DATA_ERROR;
+            }
+            const std::size_t len = LENGTH_BASE[ls] + m_Br.Read(LENGTH_EXTRA[ls]);
+            const int ds = dist.Decode(m_Br);
+            if (ds < 0 || ds >= 30){
+                seg.resize(pos);
+                return Z_DATA_ERROR;
+            }
+            const std::size_t d = DIST_BASE[ds] + m_Br.Read(DIST_EXTRA[ds]);
+
+            if constexpr (MARKERS){
+                // floor is always 0 while markers are possible
+                for (std::size_t k = 0; k < len; ++k, ++pos){
+                    std::uint16_t s;
+                    if (d > pos){
+                        s = static_cast<std::uint16_t>(256 + WINDOW_SIZE - (d - pos));
+                    }else{
+                        s = out[pos - d];
+                    }
+                    out[pos] = s;
+                    if (s >= 256){
+                        m_MarkerFreeFrom = pos + 1;
+                    }
+                }
+            }else{
+                if (d > pos - m_Floor){
+                    seg.resize(pos);
+                    return Z_DATA_ERROR;
+                }
+                const unsigned char* src = out + pos - d;
+                unsigned char* dst = out + pos;
+                if (d >= len){
+                    std::memcpy(dst, src, len);
+                }else{
+                    for (std::size_t k = 0; k < len; ++k){
+                        dst[k] = src[k];
+                    }
+                }
+                pos += len;
+            }
+        }
+        seg.resize(pos);
+        return m_Br.Overrun() ? Z_DATA_ERROR : Z_OK;
+    }
+
+    BitReader m_Br;
+    Huffman m_Lit, m_Dist;
+    Buffer<std::uint16_t> m_Seg16;
+    Buffer<unsigned char> m_Seg8;
+    std::size_t m_Prefix = 0;         // history bytes at the front of seg8 which are not output
+    std::size_t m_Floor = 0;          // seg8 index back references may not reach past (member start)
+    std::size_t m_MarkerFreeFrom = 0; // seg16 symbols from here on hold no marker
+    bool m_Markers;
+    bool m_AtMemberHeader;
+    bool m_Finished = false;
+    std::uint64_t m_Start = 0;
+    std::uint64_t m_End = 0;
+    std::vector<MemberEnd> m_Members;
+};
+
+}
+
+int Inflate(const unsigned char* in, std::size_t in_len, std::size_t chunk_size,
+            const ParallelFor& parallel_for, Result& result){
+
+    const std::size_t count = std::max<std::size_t>(1, in_len / std::max<std::size_t>(chunk_size, 1));
+    std::vector<std::uint64_t> search(count + 1);
+    for (std::size_t i = 0; i < count; ++i){
+        search[i] = static_cast<std::uint64_t>(i) * (in_len / count) * 8;
+    }
+    search[count] = NO_STOP;
+
+    // 1. every chunk finds its start and decodes up to the first block boundary in the next range
+    std::vector<std::unique_ptr<ChunkDecoder>> chunks(count);
+    std::vector<int> status(count, Z_OK);
+    parallel_for(count, [&](std::size_t i){
+        chunks[i] = std::make_unique<ChunkDecoder>(in, in_len, i == 0);
+        if (i > 0 && !chunks[i]->FindStart(search[i], search[i + 1])){
+            status[i] = NOT_FOUND;
+            return;
+        }
+        status[i] = chunks[i]->DecodeUntil(search[i + 1]);
+    });
+    if (status[0] != Z_OK){
+        return status[0];
+    }
+
+    // 2. chain: chunk j is only taken if the accepted chunk before it stops exactly at its start,
+    // otherwise that one decodes on through j's range and j is thrown away
+    std::vector<std::size_t> accepted{0};
+    for (std::size_t j = 1; j < count; ++j){
+        ChunkDecoder& current = *chunks[accepted.back()];
+        if (current.Finished()){
+            break;
+        }
+        if (status[j] != Z_OK){
+            chunks[j].reset();
+            continue;
+        }
+        if (current.End() < chunks[j]->Start()){
+            const int ret = current.DecodeUntil(chunks[j]->Start());
+            if (ret != Z_OK){
+                return ret;
+            }
+        }
+        if (!current.Finished() && current.End() == chunks[j]->Start()){
+            accepted.push_back(j);
+        }else{
+            chunks[j].reset();
+        }
+    }
+    {
+        ChunkDecoder& last = *chunks[accepted.back()];
+        const int ret = last.DecodeUntil(NO_STOP);
+        if (ret != Z_OK){
+            return ret;
+        }
+    }
+
+    // 3. place every chunk, plain bytes first (independent), then replace markers.
+    std::vector<std::uint64_t> offset(accepted.size() + 1, 0);
+    for (std::size_t k = 0; k < accepted.size(); ++k){
+        offset[k + 1] = offset[k] + chunks[accepted[k]]->OutputSize();
+    }
+    result.size = offset.back();
+    result.data = std::shared_ptr<char[]>(new char[std::max<std::uint64_t>(result.size, 1)]);
+    unsigned char* out = reinterpret_cast<unsigned char*>(result.data.get());
+
+    parallel_for(accepted.size(), [&](std::size_t k){
+        const ChunkDecoder& chunk = *chunks[accepted[k]];
+        if (chunk.ByteCount()){
+            std::memcpy(out + offset[k] + chunk.MarkerSymbols(), chunk.Bytes(), chunk.ByteCount());
+        }
+    });
+
+    std::vector<int> resolved(accepted.size(), 0);
+    auto resolve = [&](std::size_t k){
+        const ChunkDecoder& chunk = *chunks[accepted[k]];
+        const std::uint16_t* symbols = chunk.Symbols();
+        const std::size_t n = chunk.MarkerSymbols();
+        // markers pointing in front of the payload mean the stream was corrupt
+        const unsigned char* window = offset[k] >= WINDOW_SIZE ? out + offset[k] - WINDOW_SIZE : nullptr;
+        unsigned char* dst = out + offset[k];
+        for (std::size_t i = 0; i < n; ++i){
+            const std::uint16_t s = symbols[i];
+            if (s < 256){
+                dst[i] = static_cast<unsigned char>(s);
+            }else if (window){
+                dst[i] = window[s - 256];
+            }else{
+                return false;
+            }
+        }
+        return true;
+    };
+    // A chunk with less than a window of plain bytes feeds the markers of the next one,
+    // so those are resolved in order; the rest only depend on plain bytes and go in parallel.
+    bool ok = true;
+    for (std::size_t k = 0; k < accepted.size() && ok; ++k){
+        if (chunks[accepted[k]]->ByteCount() < WINDOW_SIZE){
+            ok = resolve(k);
+            resolved[k] = 1;
+        }
+    }
+    if (!ok){
+        return Z_DATA_ERROR;
+    }
+    std::vector<int> resolve_status(accepted.size(), 1);
+    parallel_for(accepted.size(), [&](std::size_t k){
+        if (!resolved[k]){
+            resolve_status[k] = resolve(k) ? 1 : 0;
+        }
+    });
+    if (std::find(resolve_status.begin(), resolve_status.end(), 0) != resolve_status.end()){
+        return Z_DATA_ERROR;
+    }
+
+    // 4. check every member's trailer, the crc computed in pieces and combined
+    std::vector<MemberEnd> members;
+    for (std::size_t k = 0; k < accepted.size(); ++k){
+        for (MemberEnd member : chunks[accepted[k]]->Members()){
+            member.out += offset[k];
+            members.push_back(member);
+        }
+    }
+    chunks.clear();
+    if (members.empty() || members.back().out != result.size){
+        return Z_DATA_ERROR;
+    }
+
+    struct Piece { std::size_t member; std::uint64_t begin, end; uLong crc; };
+    std::vector<Piece> pieces;
+    std::uint64_t begin = 0;
+    for (std::size_t m = 0; m < members.size(); begin = members[m++].out){
+        const std::uint64_t end = members[m].out;
+        std::uint64_t p = begin;
+        do {
+            pieces.push_back({m, p, std::min<std::uint64_t>(p + CRC_PIECE, end), 0});
+            p += CRC_PIECE;
+        } while (p < end);
+    }
+    parallel_for(pieces.size(), [&](std::size_t i){
+        Piece& piece = pieces[i];
+        piece.crc = crc32(crc32(0L, Z_NULL, 0), out + piece.begin, static_cast<uInt>(piece.end - piece.begin));
+    });
+    std::vector<uLong> crc(members.size(), crc32(0L, Z_NULL, 0));
+    std::vector<std::uint64_t> length(members.size(), 0);
+    for (const Piece& piece : pieces){
+        crc[piece.member] = crc32_combine(crc[piece.member], piece.crc,
+                                          static_cast<z_off_t>(piece.end - piece.begin));
+        length[piece.member] += piece.end - piece.begin;
+    }
+    for (std::size_t m = 0; m < members.size(); ++m){
+        if (crc[m] != members[m].crc || static_cast<std::uint32_t>(length[m]) != members[m].isize){
+            return Z_DATA_ERROR;
+        }
+    }
+
+    return Z_OK;
+}
+
+}